@@ -1,9 +1,14 @@
 #pragma once
 #include <llama/common.h>
 #include <llama/llama.h>
+#include <robot-ai/stop_matcher.hpp>
 #include <array>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <stop_token>
 #include <string>
 #include <thread>
 #include <vector>
@@ -14,6 +19,7 @@ namespace lma
 
     class llama;
     using llama_ptr = std::unique_ptr<llama>;
+    using piece_callback = std::function<void(const std::string&)>;
 
     struct llama_config
     {
@@ -24,6 +30,7 @@ namespace lma
         bool use_gpu;
         std::string model;
         std::string context;
+        std::string session;
     };
 
     class llama
@@ -33,28 +40,47 @@ namespace lma
         ~llama();
 
         void init();
+        void warm_up();
         auto generate_from_prompt(const std::string& prompt) -> std::string;
 
+        // Streams the answer through on_piece as it is generated. Pieces are complete UTF-8 and never contain a part
+        // of an antiprompt. Generation stops early when token is signalled, the returned answer is what was streamed.
+        auto generate_from_prompt(const std::string& prompt, const piece_callback& on_piece, std::stop_token token = {}) -> std::string;
+
         static auto build_llama(const llama_config& config) -> llama_ptr;
 
     protected:
     private:
         static constexpr size_t max_history{256};
+        static constexpr size_t shift_reserve{128};
         static constexpr std::array antiprompts{"[Answer]"sv, "[Question]"sv};
+        static constexpr uint32_t session_magic{0x73736c6c};  // "llss"
+        static constexpr size_t session_model_bytes{1 << 20};
 
         const llama_config config;
         std::vector<llama_token> embd_context;
         std::vector<llama_token> embd_history;
+        std::vector<uint8_t> penalized;
+        stop_matcher stops{antiprompts};
         std::mutex sync;
+        std::condition_variable kv_updated;
+        bool kv_update_pending{false};
+        std::future<void> kv_update;
 
         llama_model* model;
         llama_context* ctx;
         llama_batch batch;
 
         auto tokenize_prompt(std::string prompt) -> std::vector<llama_token>;
+        void wait_kv_update(std::unique_lock<std::mutex>& lock);
+        void shift_context(size_t n_needed);
+        auto stream_end(const std::string& str) const -> size_t;
         auto load_context(const std::string& file_name) -> std::vector<llama_token>;
-        auto remove_antiprompt(std::string& str) -> bool;
+        auto session_key() const -> uint64_t;
+        auto load_session() -> bool;
+        void save_session();
         auto predict_next_token() -> llama_token;
+        static auto argmax(const float* x, int32_t n) -> llama_token;
     };
 
     auto llama_get_default_config() -> llama_config;
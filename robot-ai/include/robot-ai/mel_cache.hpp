@@ -0,0 +1,37 @@
+#pragma once
+
+#include <whisper/common-sdl.h>
+#include <whisper/whisper.h>
+#include <cstdint>
+#include <vector>
+
+namespace whs
+{
+    // Rolling cache of log mel frames keyed to the absolute sample positions of audio_async
+    // Every frame is featurized once, as soon as the audio it covers has been captured. Spectrogram windows for
+    // whisper_set_mel_with_state are then assembled from the cache, so overlapping windows (consecutive commands,
+    // streaming steps, wake phrase spotting) never featurize the same audio twice.
+    class mel_cache
+    {
+    public:
+        mel_cache(whisper_context* ctx, int32_t capacity_ms);
+
+        void update(const audio_view& view);
+        auto window(uint64_t seq, size_t n_samples, int32_t n_len, std::vector<float>& mel) const -> bool;
+        void reset();
+
+    protected:
+    private:
+        static constexpr uint64_t hop{WHISPER_HOP_LENGTH};
+        static constexpr uint64_t half_window{WHISPER_N_FFT / 2};
+        static constexpr float silence{-10.0f};  // log10 of the power floor whisper uses
+
+        whisper_context* ctx;
+        const int32_t n_mel;
+        const uint64_t capacity;
+        std::vector<float> frames;
+        std::vector<float> samples;
+        uint64_t first_frame{0};
+        uint64_t next_frame{0};
+    };
+}
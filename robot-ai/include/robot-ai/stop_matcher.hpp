@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace lma
+{
+    // Incremental matcher for the stop sequences of the generated text
+    // Aho-Corasick automaton over the bytes of the stop sequences. The text is fed piece by piece as tokens are
+    // detokenized, every byte is looked at once whatever the tokenization of the stop sequence was. The depth of the
+    // current state is the longest tail of the text that could still grow into a stop sequence.
+    class stop_matcher
+    {
+    public:
+        stop_matcher(std::span<const std::string_view> patterns);
+
+        // Returns the offset in the text fed since the last reset where the first completed stop sequence begins
+        auto feed(std::string_view text) -> std::optional<size_t>;
+        auto held() const -> size_t;
+        void reset();
+
+    protected:
+    private:
+        struct node
+        {
+            std::array<int32_t, 256> next;
+            int32_t fail;
+            int32_t depth;
+            int32_t match;  // length of the stop sequence ending here, 0 if none
+        };
+
+        std::vector<node> nodes;
+        int32_t state{0};
+        size_t n_fed{0};
+    };
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace whs
+{
+    // Feature matrix of a stretch of audio: n_frames rows of n_mel normalized log-mel values
+    struct wake_features
+    {
+        int32_t n_frames;
+        int32_t n_mel;
+        std::vector<float> data;
+    };
+
+    // Keyword spotter for the wake phrase
+    // Matches log-mel features against recorded templates of the wake phrase with subsequence DTW, so the phrase
+    // can start anywhere in the analysed audio. Templates are enrolled from utterances the full transcription
+    // has already confirmed and are persisted between runs.
+    class wake_spotter
+    {
+    public:
+        wake_spotter(const std::string& file_name, float threshold);
+
+        auto has_templates() const -> bool;
+        auto needs_templates() const -> bool;
+        auto score(const wake_features& features) const -> float;
+        auto detect(float score) const -> bool;
+        auto max_template_ms() const -> int32_t;
+        void enroll(wake_features features);
+
+        static auto features_from_mel(const float* mel, int32_t n_mel, int32_t n_len, int32_t frame_begin, int32_t frame_end)
+            -> wake_features;
+
+    protected:
+    private:
+        static constexpr size_t max_templates{8};
+        static constexpr int32_t frame_ms{20};
+        static constexpr int32_t min_template_frames{10};
+        static constexpr uint32_t file_magic{0x656b6177};  // "wake"
+
+        const std::string file_name;
+        const float threshold;
+        std::deque<wake_features> templates;
+
+        auto dtw(const wake_features& tmpl, const wake_features& features) const -> float;
+        void load();
+        void save() const;
+    };
+}
@@ -2,8 +2,11 @@
 
 #include <whisper/common-sdl.h>
 #include <whisper/whisper.h>
+#include <robot-ai/mel_cache.hpp>
+#include <robot-ai/wake_spotter.hpp>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <span>
 #include <string>
@@ -21,17 +24,26 @@ namespace whs
     {
         int32_t n_threads;
         int32_t command_ms;
+        int32_t endpoint_ms;
+        int32_t step_ms;
         int32_t prompt_ms;
         int32_t capture_id;
         int32_t max_tokens;
         int32_t audio_ctx;
+        int32_t audio_ctx_margin_ms;
         float vad_threshold;
         float freq_threshold;
+        float wake_threshold;
+        float guided_threshold;
         bool use_gpu;
+        bool streaming;
+        bool command_grammar;
+        bool guided;
         std::string model;
         std::string prompt;
         std::string commands;
         std::string context;
+        std::string wake_templates;
     };
 
     class whisper
@@ -40,8 +52,10 @@ namespace whs
         whisper(const whisper_config& config);
         ~whisper();
         std::function<void(const std::string&)> on_command;
+        std::function<void(const std::string&)> on_partial;
         void start_whisper();
         void stop_whisper();
+        void warm_up();
 
         static auto build_whisper(const whisper_config& config) -> whisper_ptr;
 
@@ -50,21 +64,69 @@ namespace whs
         static constexpr size_t max_token_count{1024};
         static constexpr size_t audio_buffer_size{30 * 1000};
         static constexpr float similarity_treshold{0.7f};
+        static constexpr int32_t vad_frame_ms{20};
+        static constexpr int32_t vad_noise_ms{2000};
+        static constexpr int32_t endpoint_pad_ms{200};
+        static constexpr int32_t vad_wait_ms{100};
+        static constexpr int32_t stream_preroll_ms{300};
+        static constexpr size_t min_window_samples{WHISPER_SAMPLE_RATE * 1100 / 1000};
+        static constexpr int32_t wake_slack_ms{1000};
+        static constexpr int32_t trim_frame_samples{WHISPER_SAMPLE_RATE / 100};
+        static constexpr float trim_ratio{0.1f};
+        static constexpr int32_t encoder_frame_samples{2 * WHISPER_HOP_LENGTH};
+        static constexpr uint64_t mel_half_window{WHISPER_N_FFT / 2};
+        static constexpr int32_t audio_ctx_bucket{64};
+        static constexpr float grammar_penalty{100.0f};
+        static constexpr int32_t grammar_slack_tokens{4};
 
         const whisper_config config;
         std::string initial_context;
+        std::vector<whisper_token> context_tokens;
+        std::vector<whisper_token> stream_prompt;
         whisper_context* ctx;
+        whisper_state* state;
         audio_async audio;
+        wake_spotter spotter;
+        std::unique_ptr<mel_cache> mels;
         std::vector<float> pcmf32;
+        std::vector<float> mel_window;
+        uint64_t pcm_seq{0};
+        uint64_t audio_overruns{0};
         std::vector<std::string> commands;
+        std::vector<std::vector<whisper_grammar_element>> grammar_rules;
+        std::vector<const whisper_grammar_element*> grammar_rule_ptrs;
+        int32_t grammar_max_tokens{0};
+        std::vector<whisper_token> guided_prompt;
+        std::vector<std::vector<whisper_token>> guided_candidates;
         std::mutex sync;
         std::jthread whisper_thread;
 
+        void capture_audio(int32_t ms);
+        void capture_audio(uint64_t begin, uint64_t end);
+        auto load_cached_mel(const std::vector<float>& pcmf32, int32_t audio_ctx) -> bool;
         auto transcribe(const std::vector<float>& pcmf32) -> std::string;
+        auto transcribe_tokens(std::vector<float>& pcmf32, const std::vector<whisper_token>& prompt) -> std::vector<whisper_token_data>;
+        auto capture_command(std::stop_token token, uint64_t speech_start) -> bool;
+        auto wait_command(std::stop_token token, uint64_t speech_start) -> std::string;
+        auto wait_guided_command(std::stop_token token, uint64_t speech_start) -> std::optional<size_t>;
+        auto classify_command(const std::vector<float>& pcmf32) -> std::optional<size_t>;
+        auto stream_command(std::stop_token token) -> std::string;
+        auto process_transcription(const std::string& transcription) -> bool;
+        auto compute_wake_features(const std::vector<float>& pcmf32, int64_t begin_ms, int64_t end_ms) -> wake_features;
+        auto spot_wake_phrase(const std::vector<float>& pcmf32, int64_t length_ms) -> bool;
+        void enroll_wake_phrase();
         auto split_prompt_and_command(const std::string& str) -> std::pair<std::string, std::string>;
         auto load_commands(const std::string& file_name) -> std::vector<std::string>;
         auto load_context(const std::string& file_name) -> std::string;
+        void build_command_grammar();
+        auto match_command(const std::string& command) const -> std::string;
+        void build_guided_candidates();
+        auto tokenize(const std::string& text) const -> std::vector<whisper_token>;
+        auto trim_silence(std::vector<float>& pcmf32) const -> size_t;
+        auto audio_ctx_for(const std::vector<float>& pcmf32) const -> int32_t;
         auto whisper_get_full_params() const -> whisper_full_params;
+        auto whisper_get_stream_params() const -> whisper_full_params;
+        auto whisper_get_command_params() const -> whisper_full_params;
         void whisper_loop(std::stop_token token);
     };
 
@@ -23,7 +23,12 @@ auto main(int argc, char* argv[]) -> int
 
     llama->init();
 
-    whisper->on_command = [&](const std::string& cmd) { std::cout << std::format("Darko:{}",llama->generate_from_prompt(cmd)) << std::endl; };
+    whisper->on_command = [&](const std::string& cmd)
+    {
+        std::cout << "Darko:" << std::flush;
+        llama->generate_from_prompt(cmd, [](const std::string& piece) { std::cout << piece << std::flush; });
+        std::cout << std::endl;
+    };
     whisper->start_whisper();
 
     std::cout << "Press \"enter\" to exit..." << std::endl;
@@ -43,14 +48,25 @@ void parse_args(int argc, char* argv[], whs::whisper_config& whisper_config, lma
         ("help,h",                                      "Print help")
         ("threads,t",       po::value<int32_t>(),       "Number of threads")
         ("gpu-layers",      po::value<int32_t>(),       "GPU layers")
-        ("audio-ctx",       po::value<int32_t>(),       "Audio context size")
+        ("audio-ctx",       po::value<int32_t>(),       "Audio context size (default: sized to the utterance)")
+        ("audio-margin",    po::value<int32_t>(),       "Silence kept around the utterance in ms")
+        ("command-ms",      po::value<int32_t>(),       "Maximum command length in ms")
+        ("endpoint-ms",     po::value<int32_t>(),       "Trailing silence that ends a command in ms")
         ("vad-thold",       po::value<float>(),         "Vad threshold")
         ("freq-thold",      po::value<float>(),         "Frequency threshold")
+        ("wake-thold",      po::value<float>(),         "Wake phrase spotter threshold")
+        ("wake-templates",  po::value<std::string>(),   "Wake phrase template file")
         ("no-gpu",                                      "Don't use gpu")
+        ("stream",                                      "Streaming transcription")
+        ("step-ms",         po::value<int32_t>(),       "Streaming step in ms")
+        ("grammar",                                     "Constrain transcription to the command list")
+        ("guided",                                      "Classify commands instead of transcribing them")
+        ("guided-thold",    po::value<float>(),         "Guided mode mean log-probability threshold")
         ("whisper-model",   po::value<std::string>(),   "whisper model")
         ("llama-model",     po::value<std::string>(),   "llama model")
         ("commands",        po::value<std::string>(),   "Command file name")
         ("llama-context",   po::value<std::string>(),   "llama context")
+        ("llama-session",   po::value<std::string>(),   "llama session cache (empty to disable)")
         ("whisper-context", po::value<std::string>(),   "whisper context");
 
     po::variables_map variable_map;
@@ -75,15 +91,45 @@ void parse_args(int argc, char* argv[], whs::whisper_config& whisper_config, lma
     if (variable_map.count("audio-ctx") != 0u)
         whisper_config.audio_ctx = variable_map["audio-ctx"].as<int32_t>();
 
+    if (variable_map.count("audio-margin") != 0u)
+        whisper_config.audio_ctx_margin_ms = variable_map["audio-margin"].as<int32_t>();
+
+    if (variable_map.count("command-ms") != 0u)
+        whisper_config.command_ms = variable_map["command-ms"].as<int32_t>();
+
+    if (variable_map.count("endpoint-ms") != 0u)
+        whisper_config.endpoint_ms = variable_map["endpoint-ms"].as<int32_t>();
+
     if (variable_map.count("vad-thold") != 0u)
         whisper_config.vad_threshold = variable_map["vad-thold"].as<float>();
 
     if (variable_map.count("freq-thold") != 0u)
         whisper_config.freq_threshold = variable_map["freq-thold"].as<float>();
 
+    if (variable_map.count("wake-thold") != 0u)
+        whisper_config.wake_threshold = variable_map["wake-thold"].as<float>();
+
+    if (variable_map.count("wake-templates") != 0u)
+        whisper_config.wake_templates = variable_map["wake-templates"].as<std::string>();
+
     if (variable_map.count("no-gpu") != 0u)
         llama_config.use_gpu = whisper_config.use_gpu = false;
 
+    if (variable_map.count("stream") != 0u)
+        whisper_config.streaming = true;
+
+    if (variable_map.count("step-ms") != 0u)
+        whisper_config.step_ms = variable_map["step-ms"].as<int32_t>();
+
+    if (variable_map.count("grammar") != 0u)
+        whisper_config.command_grammar = true;
+
+    if (variable_map.count("guided") != 0u)
+        whisper_config.guided = true;
+
+    if (variable_map.count("guided-thold") != 0u)
+        whisper_config.guided_threshold = variable_map["guided-thold"].as<float>();
+
     if (variable_map.count("whisper-model") != 0u)
         whisper_config.model = variable_map["whisper-model"].as<std::string>();
 
@@ -99,5 +145,8 @@ void parse_args(int argc, char* argv[], whs::whisper_config& whisper_config, lma
     if (variable_map.count("llama-context") != 0u)
         llama_config.context = variable_map["llama-context"].as<std::string>();
 
+    if (variable_map.count("llama-session") != 0u)
+        llama_config.session = variable_map["llama-session"].as<std::string>();
+
     // clang-format on
 }
\ No newline at end of file
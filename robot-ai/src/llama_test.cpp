@@ -14,7 +14,8 @@ void parse_args(int argc, char* argv[], lma::llama_config& llama_config)
         ("gpu-layers",      po::value<int32_t>(),       "GPU layers")
         ("no-gpu",                                      "Don't use gpu")
         ("llama-model",     po::value<std::string>(),   "llama model")
-        ("llama-context",   po::value<std::string>(),   "llama context");
+        ("llama-context",   po::value<std::string>(),   "llama context")
+        ("llama-session",   po::value<std::string>(),   "llama session cache (empty to disable)");
 
     po::variables_map variable_map;
     po::store(po::parse_command_line(argc, argv, desc), variable_map);
@@ -41,6 +42,9 @@ void parse_args(int argc, char* argv[], lma::llama_config& llama_config)
     if (variable_map.count("llama-context") != 0u)
         llama_config.context = variable_map["llama-context"].as<std::string>();
 
+    if (variable_map.count("llama-session") != 0u)
+        llama_config.session = variable_map["llama-session"].as<std::string>();
+
     // clang-format on
 }
 
@@ -66,7 +70,9 @@ auto main(int argc, char* argv[]) -> int
         if (prompt.empty())
             break;
 
-        std::cout << std::format("Darko: {}", llama->generate_from_prompt(prompt)) << std::endl;
+        std::cout << "Darko: " << std::flush;
+        llama->generate_from_prompt(prompt, [](const std::string& piece) { std::cout << piece << std::flush; });
+        std::cout << std::endl;
     }
 
     return 0;
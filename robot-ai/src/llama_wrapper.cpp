@@ -1,13 +1,23 @@
+#include <bit>
 #include <exception>
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <regex>
 #include <robot-ai/llama_wrapper.hpp>
 #include <span>
 #include <sstream>
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace lma
 {
     llama::llama(const llama_config& config)
@@ -45,10 +55,21 @@ namespace lma
 
         // Init batch
         batch = llama_batch_init((int32_t) llama_n_ctx(ctx), 0, 1);
+
+        // Init sampler
+        penalized.assign(llama_n_vocab(model), 0);
     }
 
     llama::~llama()
     {
+        {
+            std::unique_lock lock{sync};
+            wait_kv_update(lock);
+        }
+
+        if (kv_update.valid())
+            kv_update.wait();
+
         llama_free(ctx);
         llama_free_model(model);
         llama_batch_free(batch);
@@ -57,42 +78,75 @@ namespace lma
 
     void llama::init()
     {
-        std::scoped_lock lock{sync};
+        std::unique_lock lock{sync};
+        wait_kv_update(lock);
         embd_history = embd_context;
 
         if (embd_history.size() > llama_n_ctx(ctx))
             throw std::runtime_error(std::format("{}: error: context to large", __func__));
 
+        if (load_session())
+            return;
+
+        llama_kv_cache_clear(ctx);
+        llama_batch_clear(batch);
         for (llama_pos i = 0; i < embd_history.size(); ++i)
             llama_batch_add(batch, embd_history[i], i, {0}, (i == embd_history.size() - 1));
 
         if (llama_decode(ctx, batch) != 0)
             throw std::runtime_error(std::format("{}: error: failed to decoded the batch", __func__));
+
+        save_session();
+    }
+
+    void llama::warm_up()
+    {
+        // One single token decode step after the context, removed from the cache again, so the generation graph is
+        // built before the first prompt
+        std::unique_lock lock{sync};
+        wait_kv_update(lock);
+        if (embd_history.empty() || embd_history.size() >= llama_n_ctx(ctx))
+            return;
+
+        const auto n_past = (llama_pos) embd_history.size();
+        llama_batch_clear(batch);
+        llama_batch_add(batch, embd_history.back(), n_past, {0}, true);
+
+        if (llama_decode(ctx, batch) != 0)
+            throw std::runtime_error(std::format("{}: error: failed to decode the batch", __func__));
+
+        llama_kv_cache_seq_rm(ctx, 0, n_past, -1);
     }
 
     auto llama::generate_from_prompt(const std::string& prompt) -> std::string
     {
-        std::scoped_lock lock{sync};
+        return generate_from_prompt(prompt, nullptr);
+    }
+
+    auto llama::generate_from_prompt(const std::string& prompt, const piece_callback& on_piece, std::stop_token token) -> std::string
+    {
+        std::unique_lock lock{sync};
+        wait_kv_update(lock);
+
         auto embd = tokenize_prompt(prompt);
         bool done = false;
         std::string result;
+        size_t n_emitted = 0;
+        stops.reset();
+
+        const auto emit = [&](size_t end)
+        {
+            if (on_piece && end > n_emitted)
+                on_piece(result.substr(n_emitted, end - n_emitted));
+            n_emitted = std::max(n_emitted, end);
+        };
+
         while (true)
         {
             if (embd.size() > 0)
             {
-                if (embd_history.size() + (int) embd.size() > llama_n_ctx(ctx))
-                {
-                    // Out of context space
-                    // Reset to original context + latest history
-
-                    const auto history_available = std::min(max_history, embd_history.size());
-                    const auto history_keep = (int64_t) std::min(history_available, llama_n_ctx(ctx) - embd_context.size() - embd.size());
-                    embd.insert(std::begin(embd), std::end(embd_history) - history_keep, std::end(embd_history));
-                    embd.insert(std::begin(embd), std::begin(embd_context), std::end(embd_context));
-                    embd_history.clear();
-
-                    llama_kv_cache_clear(ctx);
-                }
+                if (embd_history.size() + embd.size() > llama_n_ctx(ctx))
+                    shift_context(embd_history.size() + embd.size() - llama_n_ctx(ctx));
 
                 llama_batch_clear(batch);
                 for (llama_pos i = 0; i < embd.size(); ++i)
@@ -106,6 +160,13 @@ namespace lma
 
             embd.clear();
 
+            // On cancellation the last token has already been decoded, the cache matches the history
+            if (token.stop_requested())
+            {
+                result.resize(stream_end(result));
+                done = true;
+            }
+
             if (done)
                 break;
 
@@ -114,16 +175,85 @@ namespace lma
             done |= (new_token_id == llama_token_eos(model));
             if (!done)
             {
+                // The token completing an antiprompt is still decoded so the history holds the whole antiprompt
+                const auto piece = llama_token_to_piece(ctx, new_token_id);
                 embd.push_back(new_token_id);
-                result += llama_token_to_piece(ctx, new_token_id);
+                result += piece;
+
+                if (const auto stop = stops.feed(piece))
+                {
+                    result.resize(*stop);
+                    done = true;
+                }
             }
 
-            done |= remove_antiprompt(result);
+            emit(done ? result.size() : stream_end(result));
+        }
+
+        emit(result.size());
+
+        // Make room for the next exchange now, the K-shift and the defragmentation run after the answer is returned
+        if (embd_history.size() + shift_reserve > llama_n_ctx(ctx) && embd_context.size() + shift_reserve < llama_n_ctx(ctx))
+        {
+            shift_context(embd_history.size() + shift_reserve - llama_n_ctx(ctx));
+            kv_update_pending = true;
+            kv_update = std::async(std::launch::async,
+                                   [this]
+                                   {
+                                       std::scoped_lock lock{sync};
+                                       llama_kv_cache_update(ctx);
+                                       kv_update_pending = false;
+                                       kv_updated.notify_all();
+                                   });
         }
 
         return result;
     }
 
+    void llama::wait_kv_update(std::unique_lock<std::mutex>& lock)
+    {
+        // The background cache update needs sync, waiting on the condition variable releases it in the meantime
+        kv_updated.wait(lock, [this] { return !kv_update_pending; });
+    }
+
+    void llama::shift_context(size_t n_needed)
+    {
+        // Keep the persona context resident, drop the oldest history behind it and slide the rest down.
+        // The K-shift and the defragmentation are applied by the next llama_decode() or llama_kv_cache_update().
+        const auto n_keep = embd_context.size();
+        const auto n_history = embd_history.size() - n_keep;
+
+        if (n_needed > n_history)
+            throw std::runtime_error(std::format("{}: error: prompt does not fit into the context", __func__));
+
+        // discard half of the history at once so shifts stay rare
+        const auto n_discard = std::max(n_needed, n_history / 2);
+        llama_kv_cache_seq_rm(ctx, 0, (llama_pos) n_keep, (llama_pos) (n_keep + n_discard));
+        llama_kv_cache_seq_add(ctx, 0, (llama_pos) (n_keep + n_discard), (llama_pos) embd_history.size(), -(llama_pos) n_discard);
+        llama_kv_cache_defrag(ctx);
+
+        embd_history.erase(std::begin(embd_history) + n_keep, std::begin(embd_history) + n_keep + n_discard);
+    }
+
+    auto llama::stream_end(const std::string& str) const -> size_t
+    {
+        // Hold back the tail that could still grow into an antiprompt
+        const auto end = str.size() - std::min(str.size(), stops.held());
+
+        // and a UTF-8 sequence that is split between tokens
+        for (size_t i = 1; i <= std::min<size_t>(4, end); ++i)
+        {
+            const auto c = (uint8_t) str[end - i];
+            if ((c & 0xc0) == 0x80)
+                continue;
+
+            const size_t length = c < 0x80 ? 1 : (c & 0xe0) == 0xc0 ? 2 : (c & 0xf0) == 0xe0 ? 3 : 4;
+            return length > i ? end - i : end;
+        }
+
+        return end;
+    }
+
     auto llama::tokenize_prompt(std::string prompt) -> std::vector<llama_token>
     {
         prompt = std::regex_replace(prompt, std::regex(R"((\[.*?\])|(\(.*?\))|([^a-zA-Z0-9\.,\?!\s\:\'\-]))"), "");
@@ -136,43 +266,85 @@ namespace lma
     auto llama::predict_next_token() -> llama_token
     {
         const auto vocab_size = llama_n_vocab(model);
-        std::span<float> logits(llama_get_logits(ctx), vocab_size);
-
-        std::vector<llama_token_data> candidates;
-        candidates.reserve(vocab_size);
+        auto* logits = llama_get_logits(ctx);
 
-        for (llama_token token_id = 0; token_id < vocab_size; ++token_id)
-            candidates.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
+        // Repetition penalty on the distinct tokens of the recent history, applied to the logits in place.
+        // new line and eos are not affected by repetition penalties.
+        const auto nl = llama_token_nl(model);
+        const auto eos = llama_token_eos(model);
+        const auto history = std::span{embd_history}.last(std::min(max_history, embd_history.size()));
 
-        llama_token_data_array candidates_p{candidates.data(), candidates.size(), false};
-
-        // new line and eos should not be affected by repetition penalties
-        const auto nl_logit = logits[llama_token_nl(model)];
-        const auto eos_logit = logits[llama_token_eos(model)];
+        for (const auto token_id : history)
+        {
+            if (penalized[token_id] != 0 || token_id == nl || token_id == eos)
+                continue;
 
-        const auto history_keep = std::min(max_history, embd_history.size());
-        const auto history_skip = embd_history.size() - history_keep;
-        llama_sample_repetition_penalties(
-            ctx, &candidates_p, &embd_history[history_skip], history_keep, config.repetition_penalty, 0.0f, 0.0f);
+            penalized[token_id] = 1;
+            auto& logit = logits[token_id];
+            logit = logit <= 0.0f ? logit * config.repetition_penalty : logit / config.repetition_penalty;
+        }
 
-        logits[llama_token_nl(model)] = nl_logit;
-        logits[llama_token_eos(model)] = eos_logit;
+        for (const auto token_id : history)
+            penalized[token_id] = 0;
 
-        return llama_sample_token_greedy(ctx, &candidates_p);
+        return argmax(logits, vocab_size);
     }
 
-    auto llama::remove_antiprompt(std::string& str) -> bool
+    auto llama::argmax(const float* x, int32_t n) -> llama_token
     {
-        for (const auto& antiprompt : antiprompts)
+        int32_t i = 0;
+        auto best = -std::numeric_limits<float>::infinity();
+
+#if defined(__AVX__)
+        if (n >= 8)
         {
-            const auto offset = str.size() - std::min(str.size(), antiprompt.size());
-            if (auto pos = str.find(antiprompt, offset); pos != std::string::npos)
-            {
-                str = str.substr(0, pos);
-                return true;
-            }
+            auto acc = _mm256_loadu_ps(x);
+            for (i = 8; i + 8 <= n; i += 8)
+                acc = _mm256_max_ps(acc, _mm256_loadu_ps(x + i));
+
+            auto max = _mm_max_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+            max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+            max = _mm_max_ss(max, _mm_movehdup_ps(max));
+            best = _mm_cvtss_f32(max);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        if (n >= 4)
+        {
+            auto acc = vld1q_f32(x);
+            for (i = 4; i + 4 <= n; i += 4)
+                acc = vmaxq_f32(acc, vld1q_f32(x + i));
+
+            best = vmaxvq_f32(acc);
+        }
+#endif
+
+        for (; i < n; ++i)
+            best = std::max(best, x[i]);
+
+        // First index holding the maximum, the same tie break as llama_sample_token_greedy()
+        i = 0;
+
+#if defined(__AVX__)
+        const auto target = _mm256_set1_ps(best);
+        for (; i + 8 <= n; i += 8)
+        {
+            const auto mask = (unsigned) _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + i), target, _CMP_EQ_OQ));
+            if (mask != 0)
+                return i + std::countr_zero(mask);
         }
-        return false;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const auto target = vdupq_n_f32(best);
+        for (; i + 4 <= n && vmaxvq_u32(vceqq_f32(vld1q_f32(x + i), target)) == 0; i += 4)
+            ;
+#endif
+
+        for (; i < n; ++i)
+        {
+            if (x[i] == best)
+                return i;
+        }
+
+        return 0;
     }
 
     auto llama::load_context(const std::string& file_name) -> std::vector<llama_token>
@@ -187,6 +359,124 @@ namespace lma
         return llama_tokenize(model, ss.str(), true);
     }
 
+    auto llama::session_key() const -> uint64_t
+    {
+        // FNV-1a over everything the prefilled state depends on
+        uint64_t key = 0xcbf29ce484222325;
+        const auto hash = [&](const void* data, size_t size)
+        {
+            for (const auto* p = static_cast<const uint8_t*>(data); size > 0; ++p, --size)
+                key = (key ^ *p) * 0x100000001b3;
+        };
+
+        // The model is identified by its size, modification time and header, the header holds the metadata and the
+        // tensor layout. Hashing all of the weights would take longer than the prefill it saves.
+        const auto model_size = (uint64_t) std::filesystem::file_size(config.model);
+        const auto model_time = (int64_t) std::filesystem::last_write_time(config.model).time_since_epoch().count();
+        hash(&model_size, sizeof(model_size));
+        hash(&model_time, sizeof(model_time));
+
+        std::vector<char> header(std::min<uint64_t>(model_size, session_model_bytes));
+        std::ifstream ifs{config.model, std::ios::binary};
+        ifs.read(header.data(), (std::streamsize) header.size());
+        hash(header.data(), header.size());
+
+        const auto c_params = llama_context_default_params();
+        const auto n_ctx = llama_n_ctx(ctx);
+        const auto n_batch = llama_n_batch(ctx);
+        hash(&n_ctx, sizeof(n_ctx));
+        hash(&n_batch, sizeof(n_batch));
+        hash(&c_params.type_k, sizeof(c_params.type_k));
+        hash(&c_params.type_v, sizeof(c_params.type_v));
+        hash(&config.n_gpu_layers, sizeof(config.n_gpu_layers));
+        hash(embd_context.data(), embd_context.size() * sizeof(llama_token));
+
+        return key;
+    }
+
+    auto llama::load_session() -> bool
+    {
+        if (config.session.empty() || !std::filesystem::exists(config.session))
+            return false;
+
+        std::ifstream ifs{config.session, std::ios::binary};
+
+        uint32_t magic = 0;
+        uint64_t key = 0;
+        uint32_t n_tokens = 0;
+        ifs.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        ifs.read(reinterpret_cast<char*>(&key), sizeof(key));
+        ifs.read(reinterpret_cast<char*>(&n_tokens), sizeof(n_tokens));
+
+        if (!ifs || magic != session_magic || key != session_key() || n_tokens != embd_history.size())
+        {
+            std::cout << std::format("[llama_wrapper] Session cache '{}' is stale, rebuilding", config.session) << std::endl;
+            return false;
+        }
+
+        std::vector<llama_token> tokens(n_tokens);
+        ifs.read(reinterpret_cast<char*>(tokens.data()), (std::streamsize) (tokens.size() * sizeof(llama_token)));
+
+        // The state is the rest of the file, it is only ever as large as the cells in use
+        const auto state_begin = (uint64_t) ifs.tellg();
+        const auto state_size = std::filesystem::file_size(config.session) - state_begin;
+
+        if (!ifs || tokens != embd_history || state_size > llama_get_state_size(ctx))
+        {
+            std::cout << std::format("[llama_wrapper] Session cache '{}' is stale, rebuilding", config.session) << std::endl;
+            return false;
+        }
+
+        // llama_set_state_data() reads as far as the serialized state says, a corrupt state must not lead it past the
+        // buffer. The worst case size is reserved, only the pages that are read into get touched.
+        auto state = std::make_unique_for_overwrite<uint8_t[]>(llama_get_state_size(ctx));
+        ifs.read(reinterpret_cast<char*>(state.get()), (std::streamsize) state_size);
+
+        if (!ifs || llama_set_state_data(ctx, state.get()) != state_size)
+        {
+            std::cerr << std::format("{}: warning: failed to restore '{}'", __func__, config.session) << std::endl;
+            return false;
+        }
+
+        std::cout << std::format("[llama_wrapper] Restored {} context tokens from '{}'", n_tokens, config.session) << std::endl;
+        return true;
+    }
+
+    void llama::save_session()
+    {
+        if (config.session.empty())
+            return;
+
+        // llama_get_state_size() is the worst case for a full cache, only the part that is written gets touched
+        auto state = std::make_unique_for_overwrite<uint8_t[]>(llama_get_state_size(ctx));
+        const auto state_size = llama_copy_state_data(ctx, state.get());
+
+        // Written next to the target and renamed, an interrupted write never leaves a truncated cache behind
+        const auto tmp_name = config.session + ".tmp";
+        {
+            std::ofstream ofs{tmp_name, std::ios::binary | std::ios::trunc};
+
+            const auto key = session_key();
+            const auto n_tokens = (uint32_t) embd_history.size();
+            ofs.write(reinterpret_cast<const char*>(&session_magic), sizeof(session_magic));
+            ofs.write(reinterpret_cast<const char*>(&key), sizeof(key));
+            ofs.write(reinterpret_cast<const char*>(&n_tokens), sizeof(n_tokens));
+            ofs.write(reinterpret_cast<const char*>(embd_history.data()), (std::streamsize) (embd_history.size() * sizeof(llama_token)));
+            ofs.write(reinterpret_cast<const char*>(state.get()), (std::streamsize) state_size);
+
+            if (!ofs)
+            {
+                std::cerr << std::format("{}: warning: failed to write '{}'", __func__, tmp_name) << std::endl;
+                return;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp_name, config.session, ec);
+        if (ec)
+            std::cerr << std::format("{}: warning: failed to write '{}': {}", __func__, config.session, ec.message()) << std::endl;
+    }
+
     auto llama::build_llama(const llama_config& config) -> llama_ptr
     {
         try
@@ -210,6 +500,7 @@ namespace lma
             .use_gpu = true,
             .model = "./models/llama-2-7b-chat.Q5_K_M.gguf",
             .context = "./contexts/llama-darko.txt",
+            .session = "./models/llama-session.bin",
         };
     }
 }
\ No newline at end of file
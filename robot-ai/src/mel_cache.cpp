@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cstring>
+#include <robot-ai/mel_cache.hpp>
+
+namespace whs
+{
+    mel_cache::mel_cache(whisper_context* ctx, int32_t capacity_ms)
+        : ctx{ctx}
+        , n_mel{whisper_model_n_mels(ctx)}
+        , capacity{(uint64_t) capacity_ms * WHISPER_SAMPLE_RATE / 1000 / hop}
+    {
+        frames.resize(capacity * n_mel);
+    }
+
+    void mel_cache::update(const audio_view& view)
+    {
+        // Frame f is centered on sample f * hop and covers [f * hop - half_window, f * hop + half_window)
+        const auto view_end = view.seq + view.size();
+        if (view.size() == 0 || view_end < half_window)
+            return;
+
+        // The frames between the cache and the view can not be computed anymore, restart at the view
+        const auto view_first = (view.seq + half_window + hop - 1) / hop;
+        if (next_frame < view_first)
+            first_frame = next_frame = view_first;
+
+        const auto end_frame = (view_end - half_window) / hop + 1;
+        if (end_frame <= next_frame)
+            return;
+
+        if (end_frame - next_frame > capacity)
+            first_frame = next_frame = end_frame - capacity;
+
+        const auto begin = next_frame * hop - half_window;
+        samples.resize((end_frame - next_frame - 1) * hop + WHISPER_N_FFT);
+
+        const auto offset = (size_t) (begin - view.seq);
+        const auto n_first = std::min(samples.size(), view.first.size() > offset ? view.first.size() - offset : 0);
+        if (n_first > 0)
+            std::memcpy(samples.data(), view.first.data() + offset, n_first * sizeof(float));
+        if (n_first < samples.size())
+            std::memcpy(samples.data() + n_first,
+                        view.second.data() + (offset + n_first - view.first.size()),
+                        (samples.size() - n_first) * sizeof(float));
+
+        // featurize in runs that do not wrap around the end of the ring
+        for (auto frame = next_frame; frame < end_frame;)
+        {
+            const auto slot = frame % capacity;
+            const auto n_frames = std::min(end_frame - frame, capacity - slot);
+
+            whisper_pcm_to_mel_frames(ctx, samples.data() + (frame - next_frame) * hop, (int) n_frames, frames.data() + slot * n_mel);
+            frame += n_frames;
+        }
+
+        next_frame = end_frame;
+        first_frame = std::max(first_frame, next_frame > capacity ? next_frame - capacity : 0);
+    }
+
+    auto mel_cache::window(uint64_t seq, size_t n_samples, int32_t n_len, std::vector<float>& mel) const -> bool
+    {
+        // The frames of the audio have to be in the cache, except for the last one, which can still be waiting for
+        // its lookahead. That frame and the window past the audio are silence, the same as the zero padding of
+        // whisper_pcm_to_mel.
+        const auto frame_begin = (seq + hop / 2) / hop;
+        const auto n_audio = std::min((int32_t) (n_samples / hop), n_len);
+
+        if (n_audio <= 0 || frame_begin < first_frame || frame_begin + n_audio > next_frame + 1)
+            return false;
+
+        mel.assign((size_t) n_mel * n_len, silence);
+
+        for (int32_t i = 0; i < n_audio && frame_begin + i < next_frame; ++i)
+        {
+            const auto* frame = frames.data() + ((frame_begin + i) % capacity) * n_mel;
+            for (int32_t j = 0; j < n_mel; ++j)
+                mel[(size_t) j * n_len + i] = frame[j];
+        }
+
+        // clamping and normalization of log_mel_spectrogram
+        const auto mmax = *std::max_element(std::begin(mel), std::end(mel)) - 8.0f;
+        for (auto& value : mel)
+            value = (std::max(value, mmax) + 4.0f) / 4.0f;
+
+        return true;
+    }
+
+    void mel_cache::reset()
+    {
+        first_frame = next_frame = 0;
+    }
+}
@@ -3,8 +3,11 @@
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/serial_port.hpp>
 #include <boost/program_options.hpp>
+#include <chrono>
 #include <format>
+#include <future>
 #include <iostream>
+#include <mutex>
 #include <robot-ai/llama_wrapper.hpp>
 #include <robot-ai/whisper_wrapper.hpp>
 
@@ -19,9 +22,60 @@ struct robot_config
     int32_t byte_size;
 };
 
+struct robot_device
+{
+    daq::InstancePtr instance;
+    daq::DevicePtr device;
+    daq::FunctionBlockPtr fb;
+};
+
+// Wall time of the startup phases, measured from the tasks that run them
+class startup_timer
+{
+public:
+    template <typename F>
+    auto measure(const std::string& phase, F&& f) -> decltype(f())
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        const auto record = [&]
+        {
+            std::scoped_lock lock{sync};
+            phases.emplace_back(phase, std::chrono::steady_clock::now() - begin);
+        };
+
+        if constexpr (std::is_void_v<decltype(f())>)
+        {
+            f();
+            record();
+        }
+        else
+        {
+            auto result = f();
+            record();
+            return result;
+        }
+    }
+
+    void report(std::chrono::steady_clock::duration total)
+    {
+        using ms = std::chrono::duration<double, std::milli>;
+
+        std::scoped_lock lock{sync};
+        for (const auto& [phase, time] : phases)
+            std::cout << std::format("[startup] {:<16} {:>10.1f} ms", phase, ms(time).count()) << std::endl;
+        std::cout << std::format("[startup] {:<16} {:>10.1f} ms", "total", ms(total).count()) << std::endl;
+    }
+
+private:
+    std::mutex sync;
+    std::vector<std::pair<std::string, std::chrono::steady_clock::duration>> phases;
+};
+
 auto robot_get_default_config() -> robot_config;
 void parse_args(int argc, char* argv[], whs::whisper_config& whisper_config, lma::llama_config& llama_config, robot_config& robot_config);
 void process_llama_response(const std::string& rsp, boost::asio::serial_port& port, daq::FunctionBlockPtr& fb);
+auto open_serial_port(boost::asio::io_service& io_service, const robot_config& robot_config) -> boost::asio::serial_port;
+auto connect_robot(const robot_config& robot_config) -> robot_device;
 auto get_robot_fb(daq::DevicePtr& device) -> daq::FunctionBlockPtr;
 
 auto main(int argc, char* argv[]) -> int
@@ -32,31 +86,52 @@ auto main(int argc, char* argv[]) -> int
     auto robot_config = robot_get_default_config();
     parse_args(argc, argv, whisper_config, llama_config, robot_config);
 
-    // serial port
+    // The startup phases are independent, run them concurrently. whisper and llama finish with a warm-up pass so the
+    // compute buffers are allocated and the weights are paged in before the first utterance.
     boost::asio::io_service io_service;
-    boost::asio::serial_port serial_port{io_service, robot_config.serial_port};
-    serial_port.set_option(boost::asio::serial_port::baud_rate(robot_config.baud_rate));
-    serial_port.set_option(boost::asio::serial_port::character_size(robot_config.byte_size));
-    serial_port.set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one));
-    serial_port.set_option(boost::asio::serial_port::parity(boost::asio::serial_port::parity::none));
-    serial_port.set_option(boost::asio::serial_port::flow_control(boost::asio::serial_port::flow_control::none));
+    startup_timer timer;
+    const auto startup_begin = std::chrono::steady_clock::now();
+
+    const auto start_serial = [&] { return timer.measure("serial port", [&] { return open_serial_port(io_service, robot_config); }); };
+    const auto start_robot = [&] { return timer.measure("openDAQ device", [&] { return connect_robot(robot_config); }); };
 
-    // openDAQ device & function_block
-    const auto instance = daq::Instance();
-    auto device = instance.addDevice(std::format("daq.opcua://{}", robot_config.robot_ip));
-    auto robot_fb = get_robot_fb(device);
+    const auto start_whisper = [&]
+    {
+        auto whisper = timer.measure("whisper load", [&] { return whs::whisper::build_whisper(whisper_config); });
+        if (whisper)
+            timer.measure("whisper warm-up", [&] { whisper->warm_up(); });
+        return whisper;
+    };
 
-    // llama & whisper init
-    auto whisper = whs::whisper::build_whisper(whisper_config);
-    auto llama = lma::llama::build_llama(llama_config);
+    const auto start_llama = [&]
+    {
+        auto llama = timer.measure("llama load", [&] { return lma::llama::build_llama(llama_config); });
+        if (llama)
+        {
+            timer.measure("llama context", [&] { llama->init(); });
+            timer.measure("llama warm-up", [&] { llama->warm_up(); });
+        }
+        return llama;
+    };
+
+    auto serial_task = std::async(std::launch::async, start_serial);
+    auto robot_task = std::async(std::launch::async, start_robot);
+    auto whisper_task = std::async(std::launch::async, start_whisper);
+    auto llama_task = std::async(std::launch::async, start_llama);
+
+    auto serial_port = serial_task.get();
+    auto robot = robot_task.get();
+    auto whisper = whisper_task.get();
+    auto llama = llama_task.get();
 
     if (!whisper || !llama)
         exit(EXIT_FAILURE);
 
+    timer.report(std::chrono::steady_clock::now() - startup_begin);
+
     // llama & whisper start
-    whisper->on_command = [&](const std::string& rsp) { process_llama_response(rsp, serial_port, robot_fb); };
+    whisper->on_command = [&](const std::string& rsp) { process_llama_response(rsp, serial_port, robot.fb); };
     whisper->start_whisper();
-    llama->init();
 
     std::cout << "Press \"enter\" to exit..." << std::endl;
     std::cin.get();
@@ -75,14 +150,25 @@ void parse_args(int argc, char* argv[], whs::whisper_config& whisper_config, lma
         ("help,h",                                      "Print help")
         ("threads,t",       po::value<int32_t>(),       "Number of threads")
         ("gpu-layers",      po::value<int32_t>(),       "GPU layers")
-        ("audio-ctx",       po::value<int32_t>(),       "Audio context size")
+        ("audio-ctx",       po::value<int32_t>(),       "Audio context size (default: sized to the utterance)")
+        ("audio-margin",    po::value<int32_t>(),       "Silence kept around the utterance in ms")
+        ("command-ms",      po::value<int32_t>(),       "Maximum command length in ms")
+        ("endpoint-ms",     po::value<int32_t>(),       "Trailing silence that ends a command in ms")
         ("vad-thold",       po::value<float>(),         "Vad threshold")
         ("freq-thold",      po::value<float>(),         "Frequency threshold")
+        ("wake-thold",      po::value<float>(),         "Wake phrase spotter threshold")
+        ("wake-templates",  po::value<std::string>(),   "Wake phrase template file")
         ("no-gpu",                                      "Don't use gpu")
+        ("stream",                                      "Streaming transcription")
+        ("step-ms",         po::value<int32_t>(),       "Streaming step in ms")
+        ("grammar",                                     "Constrain transcription to the command list")
+        ("guided",                                      "Classify commands instead of transcribing them")
+        ("guided-thold",    po::value<float>(),         "Guided mode mean log-probability threshold")
         ("whisper-model",   po::value<std::string>(),   "whisper model")
         ("llama-model",     po::value<std::string>(),   "llama model")
         ("commands",        po::value<std::string>(),   "Command file name")
         ("llama-context",   po::value<std::string>(),   "llama context")
+        ("llama-session",   po::value<std::string>(),   "llama session cache (empty to disable)")
         ("whisper-context", po::value<std::string>(),   "whisper context")
         ("serial-port",     po::value<std::string>(),   "serial port")
         ("baud-rate",       po::value<int32_t>(),       "baud rate")
@@ -111,15 +197,45 @@ void parse_args(int argc, char* argv[], whs::whisper_config& whisper_config, lma
     if (variable_map.count("audio-ctx") != 0u)
         whisper_config.audio_ctx = variable_map["audio-ctx"].as<int32_t>();
 
+    if (variable_map.count("audio-margin") != 0u)
+        whisper_config.audio_ctx_margin_ms = variable_map["audio-margin"].as<int32_t>();
+
+    if (variable_map.count("command-ms") != 0u)
+        whisper_config.command_ms = variable_map["command-ms"].as<int32_t>();
+
+    if (variable_map.count("endpoint-ms") != 0u)
+        whisper_config.endpoint_ms = variable_map["endpoint-ms"].as<int32_t>();
+
     if (variable_map.count("vad-thold") != 0u)
         whisper_config.vad_threshold = variable_map["vad-thold"].as<float>();
 
     if (variable_map.count("freq-thold") != 0u)
         whisper_config.freq_threshold = variable_map["freq-thold"].as<float>();
 
+    if (variable_map.count("wake-thold") != 0u)
+        whisper_config.wake_threshold = variable_map["wake-thold"].as<float>();
+
+    if (variable_map.count("wake-templates") != 0u)
+        whisper_config.wake_templates = variable_map["wake-templates"].as<std::string>();
+
     if (variable_map.count("no-gpu") != 0u)
         llama_config.use_gpu = whisper_config.use_gpu = false;
 
+    if (variable_map.count("stream") != 0u)
+        whisper_config.streaming = true;
+
+    if (variable_map.count("step-ms") != 0u)
+        whisper_config.step_ms = variable_map["step-ms"].as<int32_t>();
+
+    if (variable_map.count("grammar") != 0u)
+        whisper_config.command_grammar = true;
+
+    if (variable_map.count("guided") != 0u)
+        whisper_config.guided = true;
+
+    if (variable_map.count("guided-thold") != 0u)
+        whisper_config.guided_threshold = variable_map["guided-thold"].as<float>();
+
     if (variable_map.count("whisper-model") != 0u)
         whisper_config.model = variable_map["whisper-model"].as<std::string>();
 
@@ -135,6 +251,9 @@ void parse_args(int argc, char* argv[], whs::whisper_config& whisper_config, lma
     if (variable_map.count("llama-context") != 0u)
         llama_config.context = variable_map["llama-context"].as<std::string>();
 
+    if (variable_map.count("llama-session") != 0u)
+        llama_config.session = variable_map["llama-session"].as<std::string>();
+
     if (variable_map.count("serial-port") != 0u)
         robot_config.serial_port = variable_map["serial-port"].as<std::string>();
 
@@ -169,6 +288,27 @@ void process_llama_response(const std::string& rsp, boost::asio::serial_port& po
     }
 }
 
+auto open_serial_port(boost::asio::io_service& io_service, const robot_config& robot_config) -> boost::asio::serial_port
+{
+    boost::asio::serial_port serial_port{io_service, robot_config.serial_port};
+    serial_port.set_option(boost::asio::serial_port::baud_rate(robot_config.baud_rate));
+    serial_port.set_option(boost::asio::serial_port::character_size(robot_config.byte_size));
+    serial_port.set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one));
+    serial_port.set_option(boost::asio::serial_port::parity(boost::asio::serial_port::parity::none));
+    serial_port.set_option(boost::asio::serial_port::flow_control(boost::asio::serial_port::flow_control::none));
+
+    return serial_port;
+}
+
+auto connect_robot(const robot_config& robot_config) -> robot_device
+{
+    robot_device robot{.instance = daq::Instance()};
+    robot.device = robot.instance.addDevice(std::format("daq.opcua://{}", robot_config.robot_ip));
+    robot.fb = get_robot_fb(robot.device);
+
+    return robot;
+}
+
 auto get_robot_fb(daq::DevicePtr& device) -> daq::FunctionBlockPtr
 {
     if (!device.assigned())
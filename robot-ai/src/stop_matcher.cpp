@@ -0,0 +1,89 @@
+#include <deque>
+#include <robot-ai/stop_matcher.hpp>
+
+namespace lma
+{
+    stop_matcher::stop_matcher(std::span<const std::string_view> patterns)
+    {
+        nodes.push_back(node{});
+        nodes[0].next.fill(-1);
+
+        // Trie of the patterns
+        for (const auto& pattern : patterns)
+        {
+            int32_t cur = 0;
+            for (const auto c : pattern)
+            {
+                auto& next = nodes[cur].next[(uint8_t) c];
+                if (next < 0)
+                {
+                    next = (int32_t) nodes.size();
+                    nodes.push_back(node{.fail = 0, .depth = nodes[cur].depth + 1, .match = 0});
+                    nodes.back().next.fill(-1);
+                }
+                cur = nodes[cur].next[(uint8_t) c];
+            }
+
+            if (!pattern.empty())
+                nodes[cur].match = (int32_t) pattern.size();
+        }
+
+        // Breadth first over the trie, turning it into a complete transition table. A node inherits the match of its
+        // failure node, so a stop sequence that is a suffix of a longer path is reported too.
+        std::deque<int32_t> queue;
+        for (auto& next : nodes[0].next)
+        {
+            if (next < 0)
+                next = 0;
+            else
+                queue.push_back(next);
+        }
+
+        while (!queue.empty())
+        {
+            const auto cur = queue.front();
+            queue.pop_front();
+
+            if (nodes[cur].match == 0)
+                nodes[cur].match = nodes[nodes[cur].fail].match;
+
+            for (size_t c = 0; c < 256; ++c)
+            {
+                const auto next = nodes[cur].next[c];
+                if (next < 0)
+                {
+                    nodes[cur].next[c] = nodes[nodes[cur].fail].next[c];
+                    continue;
+                }
+
+                nodes[next].fail = nodes[nodes[cur].fail].next[c];
+                queue.push_back(next);
+            }
+        }
+    }
+
+    auto stop_matcher::feed(std::string_view text) -> std::optional<size_t>
+    {
+        for (const auto c : text)
+        {
+            state = nodes[state].next[(uint8_t) c];
+            ++n_fed;
+
+            if (nodes[state].match != 0)
+                return n_fed - nodes[state].match;
+        }
+
+        return std::nullopt;
+    }
+
+    auto stop_matcher::held() const -> size_t
+    {
+        return nodes[state].depth;
+    }
+
+    void stop_matcher::reset()
+    {
+        state = 0;
+        n_fed = 0;
+    }
+}
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <robot-ai/wake_spotter.hpp>
+
+namespace whs
+{
+    wake_spotter::wake_spotter(const std::string& file_name, float threshold)
+        : file_name{file_name}
+        , threshold{threshold}
+    {
+        load();
+    }
+
+    auto wake_spotter::has_templates() const -> bool
+    {
+        return !templates.empty();
+    }
+
+    auto wake_spotter::needs_templates() const -> bool
+    {
+        return templates.size() < max_templates;
+    }
+
+    auto wake_spotter::score(const wake_features& features) const -> float
+    {
+        auto best = std::numeric_limits<float>::infinity();
+        for (const auto& tmpl : templates)
+            best = std::min(best, dtw(tmpl, features));
+
+        return best;
+    }
+
+    auto wake_spotter::detect(float score) const -> bool
+    {
+        // Without templates there is nothing to gate on, let the transcription decide
+        if (!has_templates())
+            return true;
+
+        return score < threshold;
+    }
+
+    auto wake_spotter::max_template_ms() const -> int32_t
+    {
+        int32_t n_frames = 0;
+        for (const auto& tmpl : templates)
+            n_frames = std::max(n_frames, tmpl.n_frames);
+
+        return n_frames * frame_ms;
+    }
+
+    void wake_spotter::enroll(wake_features features)
+    {
+        if (features.n_frames < min_template_frames)
+            return;
+
+        if (!templates.empty() && templates.front().n_mel != features.n_mel)
+            templates.clear();
+
+        templates.push_back(std::move(features));
+        while (templates.size() > max_templates)
+            templates.pop_front();
+
+        save();
+    }
+
+    auto wake_spotter::features_from_mel(const float* mel, int32_t n_mel, int32_t n_len, int32_t frame_begin, int32_t frame_end)
+        -> wake_features
+    {
+        frame_begin = std::clamp(frame_begin, 0, n_len);
+        frame_end = std::clamp(frame_end, frame_begin, n_len);
+
+        // mel frames are 10 ms apart, average pairs to get frame_ms frames
+        wake_features features{(frame_end - frame_begin) / 2, n_mel, {}};
+        features.data.resize((size_t) features.n_frames * n_mel);
+
+        for (int32_t i = 0; i < features.n_frames; ++i)
+        {
+            const auto frame = frame_begin + 2 * i;
+            for (int32_t j = 0; j < n_mel; ++j)
+                features.data[i * n_mel + j] = 0.5f * (mel[j * n_len + frame] + mel[j * n_len + frame + 1]);
+        }
+
+        // cepstral mean normalization removes the channel (microphone, room) from the comparison
+        for (int32_t j = 0; j < n_mel && features.n_frames > 0; ++j)
+        {
+            float mean = 0.0f;
+            for (int32_t i = 0; i < features.n_frames; ++i)
+                mean += features.data[i * n_mel + j];
+            mean /= features.n_frames;
+
+            for (int32_t i = 0; i < features.n_frames; ++i)
+                features.data[i * n_mel + j] -= mean;
+        }
+
+        // unit length frames turn the frame distance into a cosine distance
+        for (int32_t i = 0; i < features.n_frames; ++i)
+        {
+            float norm = 0.0f;
+            for (int32_t j = 0; j < n_mel; ++j)
+                norm += features.data[i * n_mel + j] * features.data[i * n_mel + j];
+
+            norm = norm > 0.0f ? 1.0f / std::sqrt(norm) : 0.0f;
+            for (int32_t j = 0; j < n_mel; ++j)
+                features.data[i * n_mel + j] *= norm;
+        }
+
+        return features;
+    }
+
+    auto wake_spotter::dtw(const wake_features& tmpl, const wake_features& features) const -> float
+    {
+        const auto n_tmpl = tmpl.n_frames;
+        const auto n_feat = features.n_frames;
+        const auto n_mel = tmpl.n_mel;
+
+        if (n_tmpl == 0 || n_feat == 0 || features.n_mel != n_mel)
+            return std::numeric_limits<float>::infinity();
+
+        const auto distance = [&](int32_t i, int32_t j)
+        {
+            const auto* a = &tmpl.data[i * n_mel];
+            const auto* b = &features.data[j * n_mel];
+
+            float dot = 0.0f;
+            for (int32_t k = 0; k < n_mel; ++k)
+                dot += a[k] * b[k];
+
+            return 1.0f - dot;
+        };
+
+        // Subsequence DTW: the template has to be matched completely, the input only partially.
+        // Columns are input frames, rows template frames, cost is accumulated together with the path length.
+        std::vector<float> cost_prev(n_tmpl), cost_cur(n_tmpl);
+        std::vector<int32_t> len_prev(n_tmpl), len_cur(n_tmpl);
+        auto best = std::numeric_limits<float>::infinity();
+
+        for (int32_t j = 0; j < n_feat; ++j)
+        {
+            for (int32_t i = 0; i < n_tmpl; ++i)
+            {
+                const auto d = distance(i, j);
+
+                if (i == 0)
+                {
+                    // free start anywhere in the input
+                    cost_cur[i] = d;
+                    len_cur[i] = 1;
+                    continue;
+                }
+
+                auto cost = cost_cur[i - 1];
+                auto len = len_cur[i - 1];
+
+                if (j > 0 && cost_prev[i - 1] <= cost)
+                {
+                    cost = cost_prev[i - 1];
+                    len = len_prev[i - 1];
+                }
+
+                if (j > 0 && cost_prev[i] < cost)
+                {
+                    cost = cost_prev[i];
+                    len = len_prev[i];
+                }
+
+                cost_cur[i] = cost + d;
+                len_cur[i] = len + 1;
+            }
+
+            best = std::min(best, cost_cur[n_tmpl - 1] / len_cur[n_tmpl - 1]);
+
+            std::swap(cost_prev, cost_cur);
+            std::swap(len_prev, len_cur);
+        }
+
+        return best;
+    }
+
+    void wake_spotter::load()
+    {
+        if (file_name.empty() || !std::filesystem::exists(file_name))
+            return;
+
+        std::ifstream ifs{file_name, std::ios::binary};
+
+        uint32_t magic = 0;
+        uint32_t count = 0;
+        ifs.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        ifs.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+        if (!ifs || magic != file_magic)
+        {
+            std::cerr << std::format("{}: warning: '{}' is not a wake template file", __func__, file_name) << std::endl;
+            return;
+        }
+
+        for (uint32_t i = 0; i < count && templates.size() < max_templates; ++i)
+        {
+            wake_features features{};
+            ifs.read(reinterpret_cast<char*>(&features.n_frames), sizeof(features.n_frames));
+            ifs.read(reinterpret_cast<char*>(&features.n_mel), sizeof(features.n_mel));
+
+            if (!ifs || features.n_frames <= 0 || features.n_mel <= 0)
+                break;
+
+            features.data.resize((size_t) features.n_frames * features.n_mel);
+            ifs.read(reinterpret_cast<char*>(features.data.data()), features.data.size() * sizeof(float));
+
+            if (!ifs)
+                break;
+
+            templates.push_back(std::move(features));
+        }
+
+        std::cout << std::format("[wake_spotter] Loaded {} wake phrase templates", templates.size()) << std::endl;
+    }
+
+    void wake_spotter::save() const
+    {
+        if (file_name.empty())
+            return;
+
+        std::ofstream ofs{file_name, std::ios::binary | std::ios::trunc};
+
+        const auto count = (uint32_t) templates.size();
+        ofs.write(reinterpret_cast<const char*>(&file_magic), sizeof(file_magic));
+        ofs.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+        for (const auto& features : templates)
+        {
+            ofs.write(reinterpret_cast<const char*>(&features.n_frames), sizeof(features.n_frames));
+            ofs.write(reinterpret_cast<const char*>(&features.n_mel), sizeof(features.n_mel));
+            ofs.write(reinterpret_cast<const char*>(features.data.data()), features.data.size() * sizeof(float));
+        }
+
+        if (!ofs)
+            std::cerr << std::format("{}: warning: failed to write '{}'", __func__, file_name) << std::endl;
+    }
+}
@@ -11,10 +11,20 @@ void parse_args(int argc, char* argv[], whs::whisper_config& whisper_config)
     desc.add_options()
         ("help,h",                                      "Print help")
         ("threads,t",       po::value<int32_t>(),       "Number of threads")
-        ("audio-ctx",       po::value<int32_t>(),       "Audio context size")
+        ("audio-ctx",       po::value<int32_t>(),       "Audio context size (default: sized to the utterance)")
+        ("audio-margin",    po::value<int32_t>(),       "Silence kept around the utterance in ms")
+        ("command-ms",      po::value<int32_t>(),       "Maximum command length in ms")
+        ("endpoint-ms",     po::value<int32_t>(),       "Trailing silence that ends a command in ms")
         ("vad-thold",       po::value<float>(),         "Vad threshold")
         ("freq-thold",      po::value<float>(),         "Frequency threshold")
+        ("wake-thold",      po::value<float>(),         "Wake phrase spotter threshold")
+        ("wake-templates",  po::value<std::string>(),   "Wake phrase template file")
         ("no-gpu",                                      "Don't use gpu")
+        ("stream",                                      "Streaming transcription")
+        ("step-ms",         po::value<int32_t>(),       "Streaming step in ms")
+        ("grammar",                                     "Constrain transcription to the command list")
+        ("guided",                                      "Classify commands instead of transcribing them")
+        ("guided-thold",    po::value<float>(),         "Guided mode mean log-probability threshold")
         ("whisper-model",   po::value<std::string>(),   "whisper model")
         ("commands",        po::value<std::string>(),   "Command file name")
         ("whisper-context", po::value<std::string>(),   "whisper context");
@@ -38,15 +48,45 @@ void parse_args(int argc, char* argv[], whs::whisper_config& whisper_config)
     if (variable_map.count("audio-ctx") != 0u)
         whisper_config.audio_ctx = variable_map["audio-ctx"].as<int32_t>();
 
+    if (variable_map.count("audio-margin") != 0u)
+        whisper_config.audio_ctx_margin_ms = variable_map["audio-margin"].as<int32_t>();
+
+    if (variable_map.count("command-ms") != 0u)
+        whisper_config.command_ms = variable_map["command-ms"].as<int32_t>();
+
+    if (variable_map.count("endpoint-ms") != 0u)
+        whisper_config.endpoint_ms = variable_map["endpoint-ms"].as<int32_t>();
+
     if (variable_map.count("vad-thold") != 0u)
         whisper_config.vad_threshold = variable_map["vad-thold"].as<float>();
 
     if (variable_map.count("freq-thold") != 0u)
         whisper_config.freq_threshold = variable_map["freq-thold"].as<float>();
 
+    if (variable_map.count("wake-thold") != 0u)
+        whisper_config.wake_threshold = variable_map["wake-thold"].as<float>();
+
+    if (variable_map.count("wake-templates") != 0u)
+        whisper_config.wake_templates = variable_map["wake-templates"].as<std::string>();
+
     if (variable_map.count("no-gpu") != 0u)
         whisper_config.use_gpu = false;
 
+    if (variable_map.count("stream") != 0u)
+        whisper_config.streaming = true;
+
+    if (variable_map.count("step-ms") != 0u)
+        whisper_config.step_ms = variable_map["step-ms"].as<int32_t>();
+
+    if (variable_map.count("grammar") != 0u)
+        whisper_config.command_grammar = true;
+
+    if (variable_map.count("guided") != 0u)
+        whisper_config.guided = true;
+
+    if (variable_map.count("guided-thold") != 0u)
+        whisper_config.guided_threshold = variable_map["guided-thold"].as<float>();
+
     if (variable_map.count("whisper-model") != 0u)
         whisper_config.model = variable_map["whisper-model"].as<std::string>();
 
@@ -69,6 +109,7 @@ auto main(int argc, char* argv[]) -> int
         return 1;
 
     whisper->on_command = [&](const auto& cmd) { std::cout << std::format("[whisper_test]: {}", cmd) << std::endl; };
+    whisper->on_partial = [&](const auto& text) { std::cout << std::format("[whisper_test] (partial): {}", text) << std::endl; };
 
     whisper->start_whisper();
 
@@ -2,10 +2,12 @@
 #include <whisper/common.h>
 #include <boost/algorithm/string.hpp>
 #include <cmath>
+#include <cwctype>
 #include <exception>
 #include <filesystem>
 #include <format>
 #include <iostream>
+#include <limits>
 #include <regex>
 #include <robot-ai/whisper_wrapper.hpp>
 #include <sstream>
@@ -18,6 +20,8 @@ namespace whs
         : config{config}
         , audio{audio_buffer_size}
         , ctx{nullptr}
+        , state{nullptr}
+        , spotter{config.wake_templates, config.wake_threshold}
     {
         if (!std::filesystem::exists(config.model))
             throw std::runtime_error(std::format("{}: error: file '{}' does not exist", __func__, config.model));
@@ -25,36 +29,155 @@ namespace whs
         if (!audio.init(config.capture_id, WHISPER_SAMPLE_RATE))
             throw std::runtime_error(std::format("{}: error: audio initialization failed", __func__));
 
+        audio.vad_enable(vad_frame_ms, vad_noise_ms, config.endpoint_ms, config.vad_threshold, config.freq_threshold);
+
         whisper_context_params_t ctx_params = whisper_context_default_params();
         ctx_params.use_gpu = config.use_gpu;
 
-        ctx = whisper_init_from_file_with_params(config.model.c_str(), ctx_params);
+        ctx = whisper_init_from_file_with_params_no_state(config.model.c_str(), ctx_params);
         if (!ctx)
             throw std::runtime_error(std::format("{}: error: failed to load context", __func__));
 
+        state = whisper_init_state(ctx);
+        if (!state)
+            throw std::runtime_error(std::format("{}: error: failed to initialize state", __func__));
+
+        mels = std::make_unique<mel_cache>(ctx, (int32_t) audio_buffer_size);
+
         commands = load_commands(config.commands);
         initial_context = load_context(config.context);
+        context_tokens = tokenize(initial_context);
+
+        if (config.command_grammar)
+            build_command_grammar();
+
+        if (config.guided)
+            build_guided_candidates();
     }
 
     whisper::~whisper()
     {
+        whisper_free_state(state);
         whisper_free(ctx);
     }
 
+    void whisper::capture_audio(int32_t ms)
+    {
+        // Featurize the new audio while it is still in the capture buffer, then take the samples
+        const auto view = audio.view(ms);
+        mels->update(view);
+        view.copy_to(pcmf32);
+        pcm_seq = view.seq;
+
+        if (!audio.valid(view))
+            mels->reset();
+    }
+
+    void whisper::capture_audio(uint64_t begin, uint64_t end)
+    {
+        // Same as above for the absolute sample range [begin, end), clamped to the audio still in the buffer.
+        // Only the span is featurized, plus the half window the first frame reaches back.
+        const auto view = audio.view_since(begin > mel_half_window ? begin - mel_half_window : 0);
+        mels->update(view);
+
+        pcmf32.clear();
+        const auto append = [&](std::span<const float> samples, uint64_t seq)
+        {
+            const auto first = std::clamp(begin, seq, seq + samples.size());
+            const auto last = std::clamp(end, first, seq + samples.size());
+            pcmf32.insert(std::end(pcmf32), std::begin(samples) + (first - seq), std::begin(samples) + (last - seq));
+        };
+
+        append(view.first, view.seq);
+        append(view.second, view.seq + view.first.size());
+        pcm_seq = std::clamp(begin, view.seq, view.seq + view.size());
+
+        if (!audio.valid(view))
+            mels->reset();
+    }
+
+    auto whisper::load_cached_mel(const std::vector<float>& pcmf32, int32_t audio_ctx) -> bool
+    {
+        // The encoder reads 2 * audio_ctx frames, the part of the window past the audio is silence
+        const auto n_audio = (int32_t) (pcmf32.size() / WHISPER_HOP_LENGTH);
+        const auto n_len = std::max(n_audio, 2 * (audio_ctx > 0 ? audio_ctx : whisper_n_audio_ctx(ctx)));
+
+        if (!mels->window(pcm_seq, pcmf32.size(), n_len, mel_window))
+            return false;
+
+        return whisper_set_mel_with_state(ctx, state, mel_window.data(), n_len, whisper_model_n_mels(ctx)) == 0;
+    }
+
     auto whisper::transcribe(const std::vector<float>& pcmf32) -> std::string
     {
-        auto params = whisper_get_full_params();
-        if (whisper_full(ctx, params, pcmf32.data(), (int) pcmf32.size()) != 0)
+        auto params = config.command_grammar ? whisper_get_command_params() : whisper_get_full_params();
+        params.audio_ctx = audio_ctx_for(pcmf32);
+        if (load_cached_mel(pcmf32, params.audio_ctx))
+        {
+            params.mel_from_state = true;
+            params.duration_ms = (int) (pcmf32.size() * 1000 / WHISPER_SAMPLE_RATE);
+        }
+
+        if (whisper_full_with_state(ctx, state, params, pcmf32.data(), (int) pcmf32.size()) != 0)
             return "";
 
         std::string result;
-        const auto n_segments = whisper_full_n_segments(ctx);
+        const auto n_segments = whisper_full_n_segments_from_state(state);
         for (auto i = 0; i < n_segments; ++i)
-            result += whisper_full_get_segment_text(ctx, i);
+            result += whisper_full_get_segment_text_from_state(state, i);
 
         return ::trim(result);
     }
 
+    auto whisper::transcribe_tokens(std::vector<float>& pcmf32, const std::vector<whisper_token>& prompt) -> std::vector<whisper_token_data>
+    {
+        // whisper_full skips anything shorter than one second, pad the window with silence
+        if (pcmf32.size() < min_window_samples)
+            pcmf32.resize(min_window_samples, 0.0f);
+
+        auto params = whisper_get_stream_params();
+        params.audio_ctx = audio_ctx_for(pcmf32);
+        if (load_cached_mel(pcmf32, params.audio_ctx))
+        {
+            params.mel_from_state = true;
+            params.duration_ms = (int) (pcmf32.size() * 1000 / WHISPER_SAMPLE_RATE);
+        }
+
+        if (!prompt.empty())
+        {
+            // The committed tokens follow the command vocabulary context, whose oldest tokens give way when the
+            // prompt would not fit into half of the text context
+            const auto n_max = (size_t) whisper_n_text_ctx(ctx) / 2;
+            const auto n_prompt = std::min(prompt.size(), n_max);
+            const auto n_context = std::min(context_tokens.size(), n_max - n_prompt);
+
+            stream_prompt.assign(std::end(context_tokens) - n_context, std::end(context_tokens));
+            stream_prompt.insert(std::end(stream_prompt), std::end(prompt) - n_prompt, std::end(prompt));
+
+            params.prompt_tokens = stream_prompt.data();
+            params.prompt_n_tokens = (int) stream_prompt.size();
+        }
+
+        std::vector<whisper_token_data> tokens;
+        if (whisper_full_with_state(ctx, state, params, pcmf32.data(), (int) pcmf32.size()) != 0)
+            return tokens;
+
+        const auto eot = whisper_token_eot(ctx);
+        const auto n_segments = whisper_full_n_segments_from_state(state);
+        for (auto i = 0; i < n_segments; ++i)
+        {
+            const auto n_tokens = whisper_full_n_tokens_from_state(state, i);
+            for (auto j = 0; j < n_tokens; ++j)
+            {
+                const auto data = whisper_full_get_token_data_from_state(state, i, j);
+                if (data.id < eot)
+                    tokens.push_back(data);
+            }
+        }
+
+        return tokens;
+    }
+
     auto whisper::split_prompt_and_command(const std::string& str) -> std::pair<std::string, std::string>
     {
         const auto prompt_length = get_words(config.prompt).size();
@@ -96,38 +219,318 @@ namespace whs
         whisper_thread.join();
     }
 
+    void whisper::warm_up()
+    {
+        // One encoder pass and one decoder step over silence, so the compute buffers are touched and the model
+        // weights are paged in before the first utterance
+        std::scoped_lock lock{sync};
+        if (whisper_thread.joinable())
+            return;
+
+        const std::vector<float> silence(min_window_samples, 0.0f);
+        const auto sot = whisper_token_sot(ctx);
+
+        whisper_set_audio_ctx_with_state(state, audio_ctx_for(silence));
+        if (whisper_pcm_to_mel_with_state(ctx, state, silence.data(), (int) silence.size(), config.n_threads) != 0 ||
+            whisper_encode_with_state(ctx, state, 0, config.n_threads) != 0 ||
+            whisper_decode_with_state(ctx, state, &sot, 1, 0, config.n_threads) != 0)
+            throw std::runtime_error(std::format("{}: error: warm-up pass failed", __func__));
+    }
+
     void whisper::whisper_loop(std::stop_token token)
     {
         audio.resume();
         std::this_thread::sleep_for(1000ms);
         audio.clear();
 
-        while (true)
+        while (!token.stop_requested())
         {
+            // The capture callback runs the VAD and wakes us up, the timeout only bounds the reaction to stop requests
+            uint64_t speech_start = 0;
+            if (audio.vad_wait(vad_wait_ms, &speech_start) != VAD_EVENT_SPEECH_START)
+                continue;
+
+            std::cout << "[whisper_wrapper] Detected speech" << std::endl;
+
+            if (config.guided)
+            {
+                const auto command = wait_guided_command(token, speech_start);
+                if (token.stop_requested())
+                    return;
+
+                if (command && on_command)
+                    on_command(commands[*command]);
+            }
+            else
+            {
+                const auto transcription = config.streaming ? stream_command(token) : wait_command(token, speech_start);
+                if (token.stop_requested())
+                    return;
+
+                if (!transcription.empty() && process_transcription(transcription) && !config.streaming && spotter.needs_templates())
+                    enroll_wake_phrase();
+            }
+
+            if (const auto overruns = audio.overruns(); overruns != audio_overruns)
+            {
+                std::cerr << std::format("[whisper_wrapper] Audio capture overruns: {}", overruns) << std::endl;
+                audio_overruns = overruns;
+            }
+
+            audio.clear();
+        }
+    }
+
+    auto whisper::capture_command(std::stop_token token, uint64_t speech_start) -> bool
+    {
+        // Endpointing: the VAD reports the end of speech after config.endpoint_ms of trailing silence, the command
+        // is cut off after config.command_ms. Only the speech and endpoint_pad_ms around it are captured.
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config.command_ms);
+        auto speech_end = std::numeric_limits<uint64_t>::max();
+        while (!token.stop_requested() && std::chrono::steady_clock::now() < deadline)
+        {
+            if (audio.vad_wait(vad_wait_ms, &speech_end) == VAD_EVENT_SPEECH_END)
+                break;
+
+            speech_end = std::numeric_limits<uint64_t>::max();
+        }
+
+        if (token.stop_requested())
+            return false;
+
+        const auto pad = (uint64_t) endpoint_pad_ms * WHISPER_SAMPLE_RATE / 1000;
+        const auto max_samples = (uint64_t) config.command_ms * WHISPER_SAMPLE_RATE / 1000;
+        const auto begin = speech_start > pad ? speech_start - pad : 0;
+        const auto end = speech_end < std::numeric_limits<uint64_t>::max() - pad ? speech_end + pad : speech_end;
+        capture_audio(begin, std::min(end, begin + max_samples + 2 * pad));
+
+        return spot_wake_phrase(pcmf32, (int64_t) pcmf32.size() * 1000 / WHISPER_SAMPLE_RATE);
+    }
+
+    auto whisper::wait_command(std::stop_token token, uint64_t speech_start) -> std::string
+    {
+        if (!capture_command(token, speech_start))
+            return "";
+
+        pcm_seq += trim_silence(pcmf32);
+
+        std::cout << std::format("[whisper_wrapper] Processing {} ms", pcmf32.size() * 1000 / WHISPER_SAMPLE_RATE) << std::endl;
+        return transcribe(pcmf32);
+    }
+
+    auto whisper::wait_guided_command(std::stop_token token, uint64_t speech_start) -> std::optional<size_t>
+    {
+        if (!capture_command(token, speech_start))
+            return std::nullopt;
+
+        pcm_seq += trim_silence(pcmf32);
+
+        std::cout << std::format("[whisper_wrapper] Classifying {} ms", pcmf32.size() * 1000 / WHISPER_SAMPLE_RATE) << std::endl;
+        return classify_command(pcmf32);
+    }
+
+    auto whisper::classify_command(const std::vector<float>& pcmf32) -> std::optional<size_t>
+    {
+        const auto audio_ctx = audio_ctx_for(pcmf32);
+        if (!load_cached_mel(pcmf32, audio_ctx) &&
+            whisper_pcm_to_mel_with_state(ctx, state, pcmf32.data(), (int) pcmf32.size(), config.n_threads) != 0)
+            return std::nullopt;
+
+        whisper_set_audio_ctx_with_state(state, audio_ctx);
+        if (whisper_encode_with_state(ctx, state, 0, config.n_threads) != 0)
+            return std::nullopt;
+
+        std::vector<const whisper_token*> candidates;
+        std::vector<int> n_candidate_tokens;
+        for (const auto& candidate : guided_candidates)
+        {
+            candidates.push_back(candidate.data());
+            n_candidate_tokens.push_back((int) candidate.size());
+        }
+
+        std::vector<float> scores(guided_candidates.size());
+        if (whisper_score_candidates_with_state(ctx,
+                                                state,
+                                                guided_prompt.data(),
+                                                (int) guided_prompt.size(),
+                                                candidates.data(),
+                                                n_candidate_tokens.data(),
+                                                (int) candidates.size(),
+                                                scores.data(),
+                                                config.n_threads) != 0)
+            return std::nullopt;
+
+        const auto best = (size_t) std::distance(std::begin(scores), std::max_element(std::begin(scores), std::end(scores)));
+        std::cout << std::format("[whisper_wrapper] (Score: {:.3f}) Command: '{}'", scores[best], commands[best]) << std::endl;
+
+        if (scores[best] < config.guided_threshold)
+            return std::nullopt;
+
+        return best;
+    }
+
+    auto whisper::stream_command(std::stop_token token) -> std::string
+    {
+        // Local agreement: tokens on which two consecutive hypotheses agree are committed, the audio they cover is
+        // dropped from the window and their text becomes the prompt for the following steps
+        const auto t_onset = std::chrono::steady_clock::now();
+
+        std::vector<whisper_token> committed;
+        std::vector<whisper_token_data> unstable;
+        std::string committed_text;
+        int64_t window_start_ms = 0;
+        bool spotted = !spotter.has_templates();
+        bool done = false;
+
+        while (!done)
+        {
+            const auto event = audio.vad_wait(config.step_ms);
             if (token.stop_requested())
-                return;
+                return "";
+
+            const auto elapsed_ms =
+                std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t_onset).count() +
+                stream_preroll_ms;
+            done = event == VAD_EVENT_SPEECH_END || elapsed_ms >= config.command_ms;
+
+            const auto window_ms = std::max<int64_t>(elapsed_ms - window_start_ms, 1);
+            capture_audio((int32_t) window_ms);
+
+            // Nothing is decoded until the spotter has seen the wake phrase
+            if (!spotted)
+            {
+                spotted = spot_wake_phrase(pcmf32, window_ms);
+                if (!spotted && (done || elapsed_ms > spotter.max_template_ms() + wake_slack_ms))
+                    return "";
+                if (!spotted)
+                    continue;
+            }
+
+            const auto hypothesis = transcribe_tokens(pcmf32, committed);
 
-            std::this_thread::sleep_for(100ms);
-            audio.get(2000, pcmf32);
+            size_t n_stable = 0;
+            if (done)
+                n_stable = hypothesis.size();
+            else
+                while (n_stable < std::min(unstable.size(), hypothesis.size()) && unstable[n_stable].id == hypothesis[n_stable].id)
+                    ++n_stable;
 
-            if (vad_simple(pcmf32, WHISPER_SAMPLE_RATE, 1000, config.vad_threshold, config.freq_threshold, false))
+            for (size_t i = 0; i < n_stable; ++i)
             {
-                std::cout << "[whisper_wrapper] Detected sound. Processing" << std::endl;
-                audio.get(config.command_ms, pcmf32);
+                committed.push_back(hypothesis[i].id);
+                committed_text += whisper_token_to_str(ctx, hypothesis[i].id);
+            }
 
-                const auto transcription = transcribe(pcmf32);
-                const auto [prompt, command] = split_prompt_and_command(transcription);
+            // token timestamps are in units of 10 ms relative to the start of the window
+            if (n_stable > 0 && hypothesis[n_stable - 1].t1 > 0)
+                window_start_ms += std::min<int64_t>(hypothesis[n_stable - 1].t1 * 10, window_ms);
 
-                const auto sim = similarity(prompt, config.prompt);
-                std::cout << std::format("[whisper_wrapper] (Match: {:.0f}%) Transcription: '{}'", sim * 100.0f, transcription)
-                          << std::endl;
+            unstable.assign(std::begin(hypothesis) + n_stable, std::end(hypothesis));
 
-                if (sim > similarity_treshold && on_command)
-                    on_command(command);
+            if (on_partial && !done)
+            {
+                std::string partial = committed_text;
+                for (const auto& data : unstable)
+                    partial += whisper_token_to_str(ctx, data.id);
 
-                audio.clear();
+                on_partial(::trim(partial));
             }
         }
+
+        return ::trim(committed_text);
+    }
+
+    auto whisper::process_transcription(const std::string& transcription) -> bool
+    {
+        const auto [prompt, command] = split_prompt_and_command(transcription);
+
+        const auto sim = similarity(prompt, config.prompt);
+        std::cout << std::format("[whisper_wrapper] (Match: {:.0f}%) Transcription: '{}'", sim * 100.0f, transcription) << std::endl;
+
+        if (sim <= similarity_treshold)
+            return false;
+
+        if (on_command)
+            on_command(config.command_grammar ? match_command(command) : command);
+
+        return true;
+    }
+
+    auto whisper::compute_wake_features(const std::vector<float>& pcmf32, int64_t begin_ms, int64_t end_ms) -> wake_features
+    {
+        const auto n_audio = (int32_t) (pcmf32.size() / WHISPER_HOP_LENGTH);
+        if (mels->window(pcm_seq, pcmf32.size(), n_audio, mel_window))
+            return wake_spotter::features_from_mel(mel_window.data(),
+                                                   whisper_model_n_mels(ctx),
+                                                   n_audio,
+                                                   (int32_t) (begin_ms / 10),
+                                                   std::min((int32_t) (end_ms / 10), n_audio));
+
+        if (whisper_pcm_to_mel_with_state(ctx, state, pcmf32.data(), (int) pcmf32.size(), config.n_threads) != 0)
+            return {};
+
+        int n_mel = 0;
+        int n_len = 0;
+        const auto* mel = whisper_get_mel_from_state(state, &n_mel, &n_len);
+        if (!mel)
+            return {};
+
+        const auto n_len_audio = whisper_n_len_from_state(state);
+        return wake_spotter::features_from_mel(mel, n_mel, n_len, (int32_t) (begin_ms / 10), std::min((int32_t) (end_ms / 10), n_len_audio));
+    }
+
+    auto whisper::spot_wake_phrase(const std::vector<float>& pcmf32, int64_t length_ms) -> bool
+    {
+        if (!spotter.has_templates())
+            return true;
+
+        const auto features = compute_wake_features(pcmf32, 0, length_ms);
+        const auto score = spotter.score(features);
+        const auto detected = spotter.detect(score);
+
+        std::cout << std::format("[whisper_wrapper] Wake phrase score: {:.3f} ({})", score, detected ? "detected" : "rejected") << std::endl;
+
+        return detected;
+    }
+
+    void whisper::enroll_wake_phrase()
+    {
+        // Use the token timestamps of the last transcription to cut the wake phrase out of pcmf32
+        const auto prompt_words = get_words(config.prompt).size();
+        const auto eot = whisper_token_eot(ctx);
+
+        size_t n_words = 0;
+        int64_t t0 = -1;
+        int64_t t1 = -1;
+
+        const auto n_segments = whisper_full_n_segments_from_state(state);
+        for (auto i = 0; i < n_segments && n_words <= prompt_words; ++i)
+        {
+            const auto n_tokens = whisper_full_n_tokens_from_state(state, i);
+            for (auto j = 0; j < n_tokens; ++j)
+            {
+                const auto data = whisper_full_get_token_data_from_state(state, i, j);
+                if (data.id >= eot)
+                    continue;
+
+                const std::string text = whisper_full_get_token_text_from_state(ctx, state, i, j);
+                if (n_words == 0 || text.starts_with(' '))
+                    ++n_words;
+
+                if (n_words > prompt_words)
+                    break;
+
+                if (t0 < 0)
+                    t0 = data.t0;
+                t1 = data.t1;
+            }
+        }
+
+        if (t0 < 0 || t1 <= t0)
+            return;
+
+        spotter.enroll(compute_wake_features(pcmf32, t0 * 10, t1 * 10));
+        std::cout << "[whisper_wrapper] Enrolled wake phrase template" << std::endl;
     }
 
     auto whisper::load_commands(const std::string& file_name) -> std::vector<std::string>
@@ -163,6 +566,232 @@ namespace whs
         return ss.str();
     }
 
+    void whisper::build_command_grammar()
+    {
+        // root    ::= lead wake-word (sep wake-word)* sep command tail
+        // lead    ::= " " |
+        // sep     ::= [ ,.!?-] sep | [ ,.!?-]
+        // tail    ::= [.!?] |
+        // command ::= command-word (sep command-word)* | ...
+        // Letters match either case, whisper capitalizes and punctuates the transcription as it sees fit.
+        enum : uint32_t
+        {
+            rule_root,
+            rule_lead,
+            rule_sep,
+            rule_tail,
+            rule_command,
+            rule_count
+        };
+
+        const auto append_char_set = [](std::vector<whisper_grammar_element>& rule, const std::wstring& chars)
+        {
+            for (size_t i = 0; i < chars.size(); ++i)
+                rule.push_back({i == 0 ? WHISPER_GRETYPE_CHAR : WHISPER_GRETYPE_CHAR_ALT, (uint32_t) chars[i]});
+        };
+
+        const auto append_phrase = [&](std::vector<whisper_grammar_element>& rule, const std::string& phrase)
+        {
+            bool first = true;
+            for (const auto& word : get_words(phrase))
+            {
+                if (word.empty())
+                    continue;
+
+                if (!first)
+                    rule.push_back({WHISPER_GRETYPE_RULE_REF, rule_sep});
+                first = false;
+
+                for (const auto c : convert_to_wstring(word))
+                {
+                    const auto lower = (wchar_t) std::towlower(c);
+                    const auto upper = (wchar_t) std::towupper(c);
+                    append_char_set(rule, lower == upper ? std::wstring{c} : std::wstring{lower, upper});
+                }
+            }
+        };
+
+        if (commands.empty())
+            throw std::runtime_error(std::format("{}: error: command grammar requires at least one command", __func__));
+
+        grammar_rules.assign(rule_count, {});
+
+        grammar_rules[rule_root] = {{WHISPER_GRETYPE_RULE_REF, rule_lead}};
+        append_phrase(grammar_rules[rule_root], config.prompt);
+        grammar_rules[rule_root].push_back({WHISPER_GRETYPE_RULE_REF, rule_sep});
+        grammar_rules[rule_root].push_back({WHISPER_GRETYPE_RULE_REF, rule_command});
+        grammar_rules[rule_root].push_back({WHISPER_GRETYPE_RULE_REF, rule_tail});
+
+        grammar_rules[rule_lead] = {{WHISPER_GRETYPE_CHAR, ' '}, {WHISPER_GRETYPE_ALT, 0}};
+
+        append_char_set(grammar_rules[rule_sep], L" ,.!?-");
+        grammar_rules[rule_sep].push_back({WHISPER_GRETYPE_RULE_REF, rule_sep});
+        grammar_rules[rule_sep].push_back({WHISPER_GRETYPE_ALT, 0});
+        append_char_set(grammar_rules[rule_sep], L" ,.!?-");
+
+        append_char_set(grammar_rules[rule_tail], L".!?");
+        grammar_rules[rule_tail].push_back({WHISPER_GRETYPE_ALT, 0});
+
+        for (size_t i = 0; i < commands.size(); ++i)
+        {
+            if (i > 0)
+                grammar_rules[rule_command].push_back({WHISPER_GRETYPE_ALT, 0});
+            append_phrase(grammar_rules[rule_command], commands[i]);
+        }
+
+        grammar_rule_ptrs.clear();
+        for (auto& rule : grammar_rules)
+        {
+            rule.push_back({WHISPER_GRETYPE_END, 0});
+            grammar_rule_ptrs.push_back(rule.data());
+        }
+
+        // The grammar only bounds the text up to the end of the command, the token limit bounds the rest
+        int32_t n_longest = 0;
+        for (const auto& command : commands)
+            n_longest = std::max(n_longest, (int32_t) tokenize(std::format(" {}, {}.", config.prompt, command)).size());
+
+        grammar_max_tokens = n_longest + grammar_slack_tokens;
+
+        std::cout << std::format("[whisper_wrapper] Command grammar: {} commands, max {} tokens", commands.size(), grammar_max_tokens)
+                  << std::endl;
+    }
+
+    auto whisper::match_command(const std::string& command) const -> std::string
+    {
+        // The grammar keeps the transcription on the command list, map it back to the exact entry
+        auto normalized = ::trim(std::regex_replace(command, std::regex("[^a-zA-Z ]"), ""));
+        std::transform(std::begin(normalized), std::end(normalized), std::begin(normalized), ::tolower);
+
+        auto best = command;
+        auto best_sim = 0.0f;
+        for (const auto& entry : commands)
+        {
+            const auto sim = similarity(normalized, entry);
+            if (sim > best_sim)
+            {
+                best = entry;
+                best_sim = sim;
+            }
+        }
+
+        return best;
+    }
+
+    void whisper::build_guided_candidates()
+    {
+        // Same decoder prompt whisper_full builds from the initial context: [prev] context [sot] (lang transcribe) [not]
+        // Every candidate is the complete sentence, so its score covers the wake phrase as well as the command.
+        if (commands.empty())
+            throw std::runtime_error(std::format("{}: error: guided mode requires at least one command", __func__));
+
+        guided_prompt.clear();
+        if (!context_tokens.empty())
+        {
+            const auto n_context = std::min<size_t>(context_tokens.size(), whisper_n_text_ctx(ctx) / 2);
+
+            guided_prompt.push_back(whisper_token_prev(ctx));
+            guided_prompt.insert(std::end(guided_prompt), std::end(context_tokens) - n_context, std::end(context_tokens));
+        }
+
+        guided_prompt.push_back(whisper_token_sot(ctx));
+        if (whisper_is_multilingual(ctx))
+        {
+            guided_prompt.push_back(whisper_token_lang(ctx, whisper_lang_id("en")));
+            guided_prompt.push_back(whisper_token_transcribe(ctx));
+        }
+        guided_prompt.push_back(whisper_token_not(ctx));
+
+        // whisper writes the wake phrase capitalized, like the start of any sentence
+        auto wake_phrase = config.prompt;
+        for (size_t i = 0; i < wake_phrase.size(); ++i)
+            if (i == 0 || wake_phrase[i - 1] == ' ')
+                wake_phrase[i] = (char) std::toupper(wake_phrase[i]);
+
+        guided_candidates.clear();
+        for (const auto& command : commands)
+            guided_candidates.push_back(tokenize(std::format(" {}, {}.", wake_phrase, command)));
+
+        std::cout << std::format("[whisper_wrapper] Guided mode: {} candidates", guided_candidates.size()) << std::endl;
+    }
+
+    auto whisper::tokenize(const std::string& text) const -> std::vector<whisper_token>
+    {
+        std::vector<whisper_token> tokens(max_token_count);
+
+        auto n_tokens = whisper_tokenize(ctx, text.c_str(), tokens.data(), (int) tokens.size());
+        if (n_tokens < 0)
+        {
+            tokens.resize(-n_tokens);
+            n_tokens = whisper_tokenize(ctx, text.c_str(), tokens.data(), (int) tokens.size());
+        }
+
+        if (n_tokens < 0)
+            throw std::runtime_error(std::format("{}: error: failed to tokenize '{}'", __func__, text));
+
+        tokens.resize(n_tokens);
+        return tokens;
+    }
+
+    auto whisper::trim_silence(std::vector<float>& pcmf32) const -> size_t
+    {
+        size_t trimmed = 0;
+
+        // Frames louder than trim_ratio of the way from the noise floor to the peak count as speech
+        const auto n_frames = pcmf32.size() / trim_frame_samples;
+        if (n_frames > 0)
+        {
+            std::vector<float> energy(n_frames);
+            for (size_t i = 0; i < n_frames; ++i)
+            {
+                float sum = 0.0f;
+                for (size_t j = 0; j < trim_frame_samples; ++j)
+                    sum += std::fabs(pcmf32[i * trim_frame_samples + j]);
+                energy[i] = sum / trim_frame_samples;
+            }
+
+            auto sorted = energy;
+            std::nth_element(std::begin(sorted), std::begin(sorted) + n_frames / 10, std::end(sorted));
+            const auto noise = sorted[n_frames / 10];
+            const auto peak = *std::max_element(std::begin(energy), std::end(energy));
+            const auto threshold = noise + trim_ratio * (peak - noise);
+
+            const auto first = std::find_if(std::begin(energy), std::end(energy), [&](float e) { return e > threshold; });
+            const auto last = std::find_if(std::rbegin(energy), std::rend(energy), [&](float e) { return e > threshold; });
+
+            if (first != std::end(energy))
+            {
+                const auto margin = (int64_t) config.audio_ctx_margin_ms * WHISPER_SAMPLE_RATE / 1000;
+                const auto begin = std::max<int64_t>((int64_t) std::distance(std::begin(energy), first) * trim_frame_samples - margin, 0);
+                const auto end = std::min<int64_t>((int64_t) std::distance(last, std::rend(energy)) * trim_frame_samples + margin,
+                                                   (int64_t) pcmf32.size());
+
+                pcmf32.erase(std::begin(pcmf32) + end, std::end(pcmf32));
+                pcmf32.erase(std::begin(pcmf32), std::begin(pcmf32) + begin);
+                trimmed = (size_t) begin;
+            }
+        }
+
+        // whisper_full skips anything shorter than one second, pad the window with silence
+        if (pcmf32.size() < min_window_samples)
+            pcmf32.resize(min_window_samples, 0.0f);
+
+        return trimmed;
+    }
+
+    auto whisper::audio_ctx_for(const std::vector<float>& pcmf32) const -> int32_t
+    {
+        if (config.audio_ctx > 0)
+            return config.audio_ctx;
+
+        // The encoder cost scales with the number of audio frames, round up to a bucket of frames that covers the
+        // audio so the encoder never sees a cut utterance
+        const auto n_frames = ((int32_t) pcmf32.size() + encoder_frame_samples - 1) / encoder_frame_samples;
+        const auto bucket = (n_frames + audio_ctx_bucket - 1) / audio_ctx_bucket * audio_ctx_bucket;
+
+        return std::min(bucket, whisper_n_audio_ctx(ctx));
+    }
+
     auto whisper::whisper_get_full_params() const -> whisper_full_params
     {
         auto params = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
@@ -184,7 +813,37 @@ namespace whs
         params.temperature_inc = 1.0f;
         params.greedy.best_of = 5;
         params.beam_search.beam_size = 5;
-        params.initial_prompt = initial_context.c_str();
+        // tokenized once at construction, whisper_full would run the tokenizer on the context for every utterance
+        params.prompt_tokens = context_tokens.empty() ? nullptr : context_tokens.data();
+        params.prompt_n_tokens = (int) context_tokens.size();
+        params.token_timestamps = true;
+
+        return params;
+    }
+
+    auto whisper::whisper_get_stream_params() const -> whisper_full_params
+    {
+        auto params = whisper_get_full_params();
+
+        // a single greedy decoder without temperature fallback keeps every step short
+        params.strategy = WHISPER_SAMPLING_GREEDY;
+        params.temperature = 0.0f;
+        params.temperature_inc = 0.0f;
+        params.greedy.best_of = 1;
+
+        return params;
+    }
+
+    auto whisper::whisper_get_command_params() const -> whisper_full_params
+    {
+        auto params = whisper_get_stream_params();
+
+        // the grammar leaves only a handful of valid continuations, a single greedy pass is enough
+        params.max_tokens = grammar_max_tokens;
+        params.grammar_rules = const_cast<const whisper_grammar_element**>(grammar_rule_ptrs.data());
+        params.n_grammar_rules = grammar_rule_ptrs.size();
+        params.i_start_rule = 0;
+        params.grammar_penalty = grammar_penalty;
 
         return params;
     }
@@ -207,17 +866,26 @@ namespace whs
         return {
             .n_threads = std::min(4, (int32_t) std::thread::hardware_concurrency()),
             .command_ms = 8000,
+            .endpoint_ms = 600,
+            .step_ms = 300,
             .prompt_ms = 5000,
             .capture_id = -1,
             .max_tokens = 32,
             .audio_ctx = -1,
+            .audio_ctx_margin_ms = 300,
             .vad_threshold = 0.6f,
             .freq_threshold = 100.0,
+            .wake_threshold = 0.35f,
+            .guided_threshold = -1.0f,
             .use_gpu = true,
+            .streaming = false,
+            .command_grammar = false,
+            .guided = false,
             .model = "./models/ggml-medium.en-q5_0.bin",
             .prompt = "hey darko",
             .commands = "./commands/commands.txt",
             .context = "./contexts/whisper-darko.txt",
+            .wake_templates = "./models/wake-templates.bin",
         };
     }
 
@@ -3,15 +3,35 @@
 #include <SDL.h>
 #include <SDL_audio.h>
 
+#include <whisper/common.h>
+
+#include <array>
 #include <atomic>
 #include <cstdint>
+#include <semaphore>
+#include <span>
 #include <vector>
-#include <mutex>
 
 //
 // SDL Audio capture
 //
 
+// Read-only view of the latest captured audio
+// Points straight into the circular buffer, split in two segments where the buffer wraps around.
+// seq is the absolute index of the first sample since capture started, use audio_async::valid() after reading
+// to make sure the samples have not been overwritten in the meantime.
+struct audio_view {
+    std::span<const float> first;
+    std::span<const float> second;
+
+    uint64_t seq = 0;
+
+    size_t size() const { return first.size() + second.size(); }
+
+    // copy the samples into a contiguous buffer (reuses its capacity)
+    void copy_to(std::vector<float> & dst) const;
+};
+
 class audio_async {
 public:
     audio_async(int len_ms);
@@ -21,6 +41,7 @@ public:
 
     // start capturing audio via the provided SDL callback
     // keep last len_ms seconds of audio in a circular buffer
+    // the callback never blocks: the buffer is a single-producer ring indexed by atomic sample counters
     bool resume();
     bool pause();
     bool clear();
@@ -31,6 +52,28 @@ public:
     // get audio data from the circular buffer
     void get(int ms, std::vector<float> & audio);
 
+    // zero-copy view of the last ms of audio (ms <= 0 - everything in the buffer)
+    audio_view view(int ms);
+
+    // zero-copy view of the audio from the absolute sample index seq up to the latest sample
+    // (clamped to the audio still in the buffer)
+    audio_view view_since(uint64_t seq);
+
+    // false if some samples of the view have been overwritten since it was taken
+    bool valid(const audio_view & view) const;
+
+    // number of times the consumer fell behind: overwritten views, dropped samples or dropped VAD events
+    uint64_t overruns() const;
+
+    // run the streaming VAD on every captured chunk (call before resume)
+    void vad_enable(int frame_ms, int noise_ms, int hangover_ms, float vad_thold, float freq_thold);
+
+    // block until the VAD reports a new event or timeout_ms elapses
+    // returns VAD_EVENT_NONE on timeout
+    // sample (optional) receives the absolute index of the first speech sample for VAD_EVENT_SPEECH_START and of the
+    // sample after the last speech frame for VAD_EVENT_SPEECH_END, comparable with audio_view::seq
+    vad_event vad_wait(int timeout_ms, uint64_t * sample = nullptr);
+
 private:
     SDL_AudioDeviceID m_dev_id_in = 0;
 
@@ -38,11 +81,35 @@ private:
     int m_sample_rate = 0;
 
     std::atomic_bool m_running;
-    std::mutex       m_mutex;
 
     std::vector<float> m_audio;
-    size_t             m_audio_pos = 0;
-    size_t             m_audio_len = 0;
+
+    // write sequence, in samples since capture started
+    // m_n_writing is advanced before the callback touches the buffer, m_n_written after it is done
+    // m_n_cleared is the value of m_n_written at the last clear()
+    std::atomic<uint64_t> m_n_writing = 0;
+    std::atomic<uint64_t> m_n_written = 0;
+    std::atomic<uint64_t> m_n_cleared = 0;
+
+    mutable std::atomic<uint64_t> m_n_overruns = 0;
+
+    struct vad_event_entry {
+        vad_event event;
+        uint32_t  gen;
+        uint64_t  sample;
+    };
+
+    // push-based VAD, the state is owned by the callback
+    // events are passed to vad_wait() through a single-producer ring, clear() bumps m_vad_gen to reset the state
+    bool                              m_vad_enabled = false;
+    vad_stream                        m_vad;
+    uint32_t                          m_vad_gen_applied = 0;
+    uint64_t                          m_vad_base = 0; // absolute index of the first sample fed since the last reset
+    std::atomic<uint32_t>             m_vad_gen  = 0;
+    std::array<vad_event_entry, 16>   m_vad_events;
+    std::atomic<uint32_t>             m_vad_head = 0;
+    std::atomic<uint32_t>             m_vad_tail = 0;
+    std::counting_semaphore<>         m_vad_sem{0};
 };
 
 // Return false if need to quit
@@ -106,15 +106,88 @@ void high_pass_filter(
         float cutoff,
         float sample_rate);
 
-// Basic voice activity detection (VAD) using audio energy adaptive threshold
+// Voice activity detection over a whole buffer
+// Runs vad_stream over pcmf32 (the buffer is not modified) and returns true if it contains speech that has
+// already ended, i.e. the speech was followed by at least last_ms of silence.
 bool vad_simple(
-        std::vector<float> & pcmf32,
+        const std::vector<float> & pcmf32,
         int   sample_rate,
         int   last_ms,
         float vad_thold,
         float freq_thold,
         bool  verbose);
 
+// Streaming voice activity detection
+// Fed with consecutive chunks of PCM audio (e.g. from the capture callback). The samples are high-pass filtered
+// and cut into frames, every frame is classified from its energy relative to a tracked noise floor, its zero
+// crossing rate and its spectral flatness. Onset and hangover timers turn the frame decisions into events.
+// The filter state, the noise floor and the timers are kept between calls, so every sample is processed
+// exactly once and an event is reported as soon as the frame that triggers it is complete.
+
+enum vad_event {
+    VAD_EVENT_NONE = 0,
+    VAD_EVENT_SPEECH_START, // n_onset consecutive speech frames
+    VAD_EVENT_SPEECH_END,   // n_hangover consecutive frames without speech
+};
+
+struct vad_stream {
+    int   frame_size     = 0;    // samples per frame
+    int   fft_size       = 0;    // samples of the frame used for the spectral flatness (power of two)
+    int   n_onset        = 0;    // consecutive speech frames needed for VAD_EVENT_SPEECH_START
+    int   n_hangover     = 0;    // consecutive non-speech frames needed for VAD_EVENT_SPEECH_END
+    int   n_warmup       = 0;    // frames used to seed the noise floor, no decisions are made before
+    float vad_thold      = 0.0f; // a frame is loud when vad_thold*energy exceeds the noise floor
+    float noise_rise     = 0.0f; // per-frame adaptation rate of the noise floor towards louder frames
+    float flatness_thold = 0.0f; // frames flatter than this are noise-like
+    float zcr_thold      = 0.0f; // frames crossing zero less often than this are voiced
+    float alpha          = 0.0f; // high-pass filter coefficient (0 = disabled)
+
+    // high-pass filter state
+    float hp_x = 0.0f;
+    float hp_y = 0.0f;
+
+    // frame being accumulated
+    std::vector<float> frame;
+    int frame_len = 0;
+
+    // spectral flatness
+    std::vector<float> window;
+    std::vector<float> twiddle;  // cos, sin pairs
+    std::vector<float> fft_re;
+    std::vector<float> fft_im;
+
+    // adaptive noise floor (RMS)
+    float noise    = 0.0f;
+    int   n_frames = 0;
+
+    // samples processed since the last reset
+    int64_t n_samples = 0;
+
+    bool    speech    = false;
+    int     n_run     = 0;  // consecutive frames disagreeing with the current state
+    int64_t run_start = 0;  // first sample of the current run of speech frames
+    int64_t run_end   = 0;  // end of the last speech frame
+
+    // sample indices (since the last reset) of the last reported events, -1 if none
+    int64_t speech_start = -1;
+    int64_t speech_end   = -1;
+};
+
+void vad_stream_init(
+        vad_stream & vad,
+        int   sample_rate,
+        int   frame_ms,
+        int   noise_ms,
+        int   hangover_ms,
+        float vad_thold,
+        float freq_thold);
+
+// forget the history, keep the configuration
+void vad_stream_reset(vad_stream & vad);
+
+// process the next chunk of samples and return the last event it produced
+vad_event vad_stream_feed(vad_stream & vad, const float * samples, int n_samples);
+
 // compute similarity between two strings using Levenshtein distance
 float similarity(const std::string & s0, const std::string & s1);
 
@@ -114,6 +114,7 @@ extern "C" {
     struct whisper_context_params {
         bool  use_gpu;
         int   gpu_device;  // CUDA device
+        bool  use_mmap;    // map the model file, tensors suitably aligned in the file are used in place on the CPU
 
         // [EXPERIMENTAL] Token-level timestamps with DTW
         bool dtw_token_timestamps;
@@ -298,6 +299,27 @@ extern "C" {
                                int   n_len,
                                int   n_mel);
 
+    // Compute the raw log10 mel energies of n_frames consecutive frames, without the clamping and normalization
+    // that whisper_pcm_to_mel() applies to the whole spectrogram. Frame i is the windowed WHISPER_N_FFT samples
+    // starting at samples[i*WHISPER_HOP_LENGTH], so samples must hold (n_frames - 1)*WHISPER_HOP_LENGTH + WHISPER_N_FFT
+    // values. Meant for callers that featurize a stream incrementally and build their own spectrogram windows.
+    // out receives n_frames rows of n_mel values
+    // Returns 0 on success
+    WHISPER_API int whisper_pcm_to_mel_frames(
+            struct whisper_context * ctx,
+                       const float * samples,
+                               int   n_frames,
+                             float * out);
+
+    // Get the log mel spectrogram stored inside the given state.
+    // The data is laid out as n_mel rows of n_len frames each. Only the first whisper_n_len_from_state() frames are
+    // computed from the audio, the rest is padding.
+    // Returns NULL if no spectrogram has been computed yet
+    WHISPER_API const float * whisper_get_mel_from_state(
+              struct whisper_state * state,
+                               int * n_mel,
+                               int * n_len);
+
     // Run the Whisper encoder on the log mel spectrogram stored inside the default state in the provided whisper context.
     // Make sure to call whisper_pcm_to_mel() or whisper_set_mel() first.
     // offset can be used to specify the offset of the first frame in the spectrogram.
@@ -334,6 +356,29 @@ extern "C" {
                                int   n_past,
                                int   n_threads);
 
+    // Score a set of candidate continuations of a prompt against the audio encoded in the state.
+    // Make sure to call whisper_encode_with_state() first.
+    // The prompt is decoded once and its KV cache is shared by all candidates, which are then evaluated together in a
+    // single batched decoder pass. scores[i] receives the mean log-probability of the tokens of candidate i.
+    // The prompt plus all candidate tokens must fit in whisper_n_text_ctx().
+    // Returns 0 on success
+    WHISPER_API int whisper_score_candidates_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+               const whisper_token * prompt,
+                               int   n_prompt,
+       const whisper_token * const * candidates,
+                         const int * n_candidate_tokens,
+                               int   n_candidates,
+                             float * scores,
+                               int   n_threads);
+
+    // Number of audio context frames the encoder uses for this state (0 - use the model default)
+    // whisper_full() overrides it with whisper_full_params.audio_ctx
+    WHISPER_API void whisper_set_audio_ctx_with_state(
+              struct whisper_state * state,
+                               int   audio_ctx);
+
     // Convert the provided text into tokens.
     // The tokens pointer must be large enough to hold the resulting tokens.
     // Returns the number of tokens on success, no more than n_max_tokens
@@ -501,6 +546,7 @@ extern "C" {
         bool speed_up;          // speed-up the audio by 2x using Phase Vocoder
         bool debug_mode;        // enable debug_mode provides extra info (eg. Dump log_mel)
         int  audio_ctx;         // overwrite the audio context size (0 = use default)
+        bool mel_from_state;    // use the spectrogram already in the state (whisper_set_mel_with_state), samples only feed token timestamps
 
         // [EXPERIMENTAL] [TDRZ] tinydiarize
         bool tdrz_enable;       // enable tinydiarize speaker turn detection
@@ -593,8 +639,8 @@ extern "C" {
     // Split the input audio in chunks and process each chunk separately using whisper_full_with_state()
     // Result is stored in the default state of the context
     // Not thread safe if executed in parallel on the same context.
-    // It seems this approach can offer some speedup in some cases.
-    // However, the transcription accuracy can be worse at the beginning and end of each chunk.
+    // The chunks are cut at the quietest point near each even split, so boundaries fall into pauses whenever the
+    // audio has them. The extra states are kept by the context and reused by the following calls.
     WHISPER_API int whisper_full_parallel(
                 struct whisper_context * ctx,
             struct whisper_full_params   params,
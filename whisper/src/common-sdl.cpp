@@ -1,5 +1,7 @@
 #include <whisper/common-sdl.h>
 
+#include <algorithm>
+
 audio_async::audio_async(int len_ms) {
     m_len_ms = len_ms;
 
@@ -123,17 +125,15 @@ bool audio_async::clear() {
         return false;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-
-        m_audio_pos = 0;
-        m_audio_len = 0;
-    }
+    // everything written so far is forgotten, the callback resets the VAD before its next chunk
+    m_n_cleared.store(m_n_written.load(std::memory_order_acquire), std::memory_order_relaxed);
+    m_vad_gen.fetch_add(1, std::memory_order_release);
 
     return true;
 }
 
 // callback to be called by SDL
+// single producer: it is the only writer of the ring, m_n_writing, m_n_written and the VAD state
 void audio_async::callback(uint8_t * stream, int len) {
     if (!m_running) {
         return;
@@ -145,74 +145,168 @@ void audio_async::callback(uint8_t * stream, int len) {
         n_samples = m_audio.size();
 
         stream += (len - (n_samples * sizeof(float)));
+
+        m_n_overruns.fetch_add(1, std::memory_order_relaxed);
     }
 
-    //fprintf(stderr, "%s: %zu samples, pos %zu, len %zu\n", __func__, n_samples, m_audio_pos, m_audio_len);
+    // claim the samples before overwriting them, readers of views validate against this
+    const uint64_t n_written = m_n_written.load(std::memory_order_relaxed);
+    m_n_writing.store(n_written + n_samples, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
+    const size_t pos = n_written % m_audio.size();
+
+    if (pos + n_samples > m_audio.size()) {
+        const size_t n0 = m_audio.size() - pos;
 
-        if (m_audio_pos + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - m_audio_pos;
+        memcpy(&m_audio[pos], stream, n0 * sizeof(float));
+        memcpy(&m_audio[0], stream + n0 * sizeof(float), (n_samples - n0) * sizeof(float));
+    } else {
+        memcpy(&m_audio[pos], stream, n_samples * sizeof(float));
+    }
 
-            memcpy(&m_audio[m_audio_pos], stream, n0 * sizeof(float));
-            memcpy(&m_audio[0], stream + n0 * sizeof(float), (n_samples - n0) * sizeof(float));
+    m_n_written.store(n_written + n_samples, std::memory_order_release);
 
-            m_audio_pos = (m_audio_pos + n_samples) % m_audio.size();
-            m_audio_len = m_audio.size();
-        } else {
-            memcpy(&m_audio[m_audio_pos], stream, n_samples * sizeof(float));
+    if (m_vad_enabled) {
+        const uint32_t gen = m_vad_gen.load(std::memory_order_acquire);
+        if (gen != m_vad_gen_applied) {
+            vad_stream_reset(m_vad);
+            m_vad_gen_applied = gen;
+            m_vad_base = n_written;
+        }
 
-            m_audio_pos = (m_audio_pos + n_samples) % m_audio.size();
-            m_audio_len = std::min(m_audio_len + n_samples, m_audio.size());
+        const vad_event event = vad_stream_feed(m_vad, (const float *) stream, n_samples);
+        if (event != VAD_EVENT_NONE) {
+            const uint32_t head = m_vad_head.load(std::memory_order_relaxed);
+            if (head - m_vad_tail.load(std::memory_order_acquire) < m_vad_events.size()) {
+                const int64_t sample = event == VAD_EVENT_SPEECH_START ? m_vad.speech_start : m_vad.speech_end;
+                m_vad_events[head % m_vad_events.size()] = { event, gen, m_vad_base + (uint64_t) sample };
+                m_vad_head.store(head + 1, std::memory_order_release);
+                m_vad_sem.release();
+            } else {
+                m_n_overruns.fetch_add(1, std::memory_order_relaxed);
+            }
         }
     }
 }
 
 void audio_async::get(int ms, std::vector<float> & result) {
+    result.clear();
+
+    const audio_view view = this->view(ms);
+    view.copy_to(result);
+
+    if (!valid(view)) {
+        fprintf(stderr, "%s: audio was overwritten while reading\n", __func__);
+    }
+}
+
+audio_view audio_async::view(int ms) {
+    if (ms <= 0) {
+        ms = m_len_ms;
+    }
+
+    const uint64_t n_written = m_n_written.load(std::memory_order_acquire);
+    const uint64_t n_samples = ((uint64_t) m_sample_rate * ms) / 1000;
+
+    return view_since(n_written > n_samples ? n_written - n_samples : 0);
+}
+
+audio_view audio_async::view_since(uint64_t seq) {
     if (!m_dev_id_in) {
         fprintf(stderr, "%s: no audio device to get audio from!\n", __func__);
-        return;
+        return {};
     }
 
     if (!m_running) {
         fprintf(stderr, "%s: not running!\n", __func__);
-        return;
+        return {};
     }
 
-    result.clear();
+    const uint64_t n_written = m_n_written.load(std::memory_order_acquire);
+    const uint64_t n_cleared = m_n_cleared.load(std::memory_order_relaxed);
+    const uint64_t n_audio   = std::min<uint64_t>(n_written - n_cleared, m_audio.size());
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
+    seq = std::clamp(seq, n_written - n_audio, n_written);
 
-        if (ms <= 0) {
-            ms = m_len_ms;
-        }
+    const size_t n_samples = (size_t) (n_written - seq);
+    if (n_samples == 0) {
+        return {};
+    }
 
-        size_t n_samples = (m_sample_rate * ms) / 1000;
-        if (n_samples > m_audio_len) {
-            n_samples = m_audio_len;
-        }
+    audio_view result;
+    result.seq = seq;
 
-        result.resize(n_samples);
+    const size_t s0 = result.seq % m_audio.size();
 
-        if (result.size() == 0)
-            return;
+    if (s0 + n_samples > m_audio.size()) {
+        const size_t n0 = m_audio.size() - s0;
 
-        int s0 = m_audio_pos - n_samples;
-        if (s0 < 0) {
-            s0 += m_audio.size();
-        }
+        result.first  = std::span<const float>(&m_audio[s0], n0);
+        result.second = std::span<const float>(&m_audio[0], n_samples - n0);
+    } else {
+        result.first  = std::span<const float>(&m_audio[s0], n_samples);
+    }
+
+    return result;
+}
+
+bool audio_async::valid(const audio_view & view) const {
+    // order the reads of the samples before the check
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (m_n_writing.load(std::memory_order_relaxed) > view.seq + m_audio.size()) {
+        m_n_overruns.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t audio_async::overruns() const {
+    return m_n_overruns.load(std::memory_order_relaxed);
+}
 
-        if (s0 + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - s0;
+void audio_view::copy_to(std::vector<float> & dst) const {
+    dst.resize(size());
 
-            memcpy(result.data(), &m_audio[s0], n0 * sizeof(float));
-            memcpy(&result[n0], &m_audio[0], (n_samples - n0) * sizeof(float));
-        } else {
-            memcpy(result.data(), &m_audio[s0], n_samples * sizeof(float));
+    if (!first.empty()) {
+        memcpy(dst.data(), first.data(), first.size() * sizeof(float));
+    }
+    if (!second.empty()) {
+        memcpy(dst.data() + first.size(), second.data(), second.size() * sizeof(float));
+    }
+}
+
+void audio_async::vad_enable(int frame_ms, int noise_ms, int hangover_ms, float vad_thold, float freq_thold) {
+    if (m_running) {
+        fprintf(stderr, "%s: enable the VAD before resuming the capture!\n", __func__);
+        return;
+    }
+
+    vad_stream_init(m_vad, m_sample_rate, frame_ms, noise_ms, hangover_ms, vad_thold, freq_thold);
+
+    m_vad_enabled = true;
+}
+
+vad_event audio_async::vad_wait(int timeout_ms, uint64_t * sample) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    // events produced before the last clear() are dropped
+    while (m_vad_sem.try_acquire_until(deadline)) {
+        const uint32_t tail = m_vad_tail.load(std::memory_order_relaxed);
+        const vad_event_entry entry = m_vad_events[tail % m_vad_events.size()];
+        m_vad_tail.store(tail + 1, std::memory_order_release);
+
+        if (entry.gen == m_vad_gen.load(std::memory_order_relaxed)) {
+            if (sample) {
+                *sample = entry.sample;
+            }
+            return entry.event;
         }
     }
+
+    return VAD_EVENT_NONE;
 }
 
 bool sdl_poll_events() {
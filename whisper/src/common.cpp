@@ -2,6 +2,8 @@
 
 #include <whisper/common.h>
 
+#include <algorithm>
+#include <bit>
 #include <cmath>
 #include <cstring>
 #include <fstream>
@@ -10,6 +12,12 @@
 #include <codecvt>
 #include <sstream>
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #if defined(_MSC_VER)
 #pragma warning(disable: 4244 4267) // possible loss of data
 #endif
@@ -499,7 +507,7 @@ void high_pass_filter(std::vector<float> & data, float cutoff, float sample_rate
     }
 }
 
-bool vad_simple(std::vector<float> & pcmf32, int sample_rate, int last_ms, float vad_thold, float freq_thold, bool verbose) {
+bool vad_simple(const std::vector<float> & pcmf32, int sample_rate, int last_ms, float vad_thold, float freq_thold, bool verbose) {
     const int n_samples      = pcmf32.size();
     const int n_samples_last = (sample_rate * last_ms) / 1000;
 
@@ -508,33 +516,274 @@ bool vad_simple(std::vector<float> & pcmf32, int sample_rate, int last_ms, float
         return false;
     }
 
+    vad_stream vad;
+    vad_stream_init(vad, sample_rate, 20, (1000 * n_samples) / sample_rate, last_ms, vad_thold, freq_thold);
+    vad_stream_feed(vad, pcmf32.data(), n_samples);
+
+    if (verbose) {
+        fprintf(stderr, "%s: noise: %f, speech_start: %lld, speech_end: %lld, vad_thold: %f, freq_thold: %f\n", __func__,
+                vad.noise, (long long) vad.speech_start, (long long) vad.speech_end, vad_thold, freq_thold);
+    }
+
+    return !vad.speech && vad.speech_end >= 0;
+}
+
+void vad_stream_init(vad_stream & vad, int sample_rate, int frame_ms, int noise_ms, int hangover_ms, float vad_thold, float freq_thold) {
+    vad.frame_size     = std::max(16, (sample_rate * frame_ms) / 1000);
+    vad.n_onset        = std::max(1, 60 / std::max(1, frame_ms));
+    vad.n_hangover     = std::max(1, hangover_ms / std::max(1, frame_ms));
+    vad.n_warmup       = std::max(1, 200 / std::max(1, frame_ms));
+    vad.vad_thold      = vad_thold;
+    vad.noise_rise     = std::clamp((float) frame_ms / std::max(1, noise_ms), 0.0f, 1.0f);
+    vad.flatness_thold = 0.4f;
+    vad.zcr_thold      = 0.15f;
+
+    // first-order high-pass, y[i] = alpha*(y[i-1] + x[i] - x[i-1])
     if (freq_thold > 0.0f) {
-        high_pass_filter(pcmf32, freq_thold, sample_rate);
+        const float rc = 1.0f / (2.0f * M_PI * freq_thold);
+        const float dt = 1.0f / sample_rate;
+        vad.alpha = rc / (rc + dt);
+    } else {
+        vad.alpha = 0.0f;
     }
 
-    float energy_all  = 0.0f;
-    float energy_last = 0.0f;
+    vad.fft_size = 1;
+    while (2*vad.fft_size <= vad.frame_size) {
+        vad.fft_size *= 2;
+    }
 
-    for (int i = 0; i < n_samples; i++) {
-        energy_all += fabsf(pcmf32[i]);
+    const int n = vad.fft_size;
 
-        if (i >= n_samples - n_samples_last) {
-            energy_last += fabsf(pcmf32[i]);
+    vad.frame.assign(vad.frame_size, 0.0f);
+    vad.window.resize(n);
+    for (int i = 0; i < n; i++) {
+        vad.window[i] = 0.5f*(1.0f - cosf((2.0f*M_PI*i)/n));
+    }
+    vad.twiddle.resize(n);
+    for (int i = 0; i < n/2; i++) {
+        vad.twiddle[2*i + 0] =  cosf((2.0f*M_PI*i)/n);
+        vad.twiddle[2*i + 1] = -sinf((2.0f*M_PI*i)/n);
+    }
+    vad.fft_re.resize(n);
+    vad.fft_im.resize(n);
+
+    vad_stream_reset(vad);
+}
+
+void vad_stream_reset(vad_stream & vad) {
+    vad.hp_x = 0.0f;
+    vad.hp_y = 0.0f;
+
+    vad.frame_len = 0;
+
+    vad.noise    = 0.0f;
+    vad.n_frames = 0;
+
+    vad.n_samples = 0;
+
+    vad.speech    = false;
+    vad.n_run     = 0;
+    vad.run_start = 0;
+    vad.run_end   = 0;
+
+    vad.speech_start = -1;
+    vad.speech_end   = -1;
+}
+
+// sum of squares and number of sign changes of x[0..n)
+static void vad_frame_stats(const float * x, int n, float & sum_sq, int & n_zc) {
+    sum_sq = 0.0f;
+    n_zc   = 0;
+
+    int i = 0;
+
+#if defined(__AVX__)
+    __m256 acc = _mm256_setzero_ps();
+    for (; i + 8 < n; i += 8) {
+        const __m256 a = _mm256_loadu_ps(x + i);
+        const __m256 b = _mm256_loadu_ps(x + i + 1);
+
+        acc   = _mm256_add_ps(acc, _mm256_mul_ps(a, a));
+        n_zc += std::popcount((unsigned) _mm256_movemask_ps(_mm256_xor_ps(a, b)));
+    }
+
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    sum_sq = _mm_cvtss_f32(sum);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 < n; i += 4) {
+        const float32x4_t a = vld1q_f32(x + i);
+        const float32x4_t b = vld1q_f32(x + i + 1);
+
+        acc = vmlaq_f32(acc, a, a);
+
+        // the xor of the sign bits is 1 << 31 in every lane that crosses zero
+        const uint32x4_t s = vshrq_n_u32(veorq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)), 31);
+        n_zc += vaddvq_u32(s);
+    }
+    sum_sq = vaddvq_f32(acc);
+#endif
+
+    for (; i < n; i++) {
+        sum_sq += x[i]*x[i];
+        if (i + 1 < n && std::signbit(x[i]) != std::signbit(x[i + 1])) {
+            n_zc++;
         }
     }
+}
 
-    energy_all  /= n_samples;
-    energy_last /= n_samples_last;
+// geometric over arithmetic mean of the power spectrum of the frame, close to 1 for noise and 0 for tones
+static float vad_frame_flatness(vad_stream & vad) {
+    const int n = vad.fft_size;
 
-    if (verbose) {
-        fprintf(stderr, "%s: energy_all: %f, energy_last: %f, vad_thold: %f, freq_thold: %f\n", __func__, energy_all, energy_last, vad_thold, freq_thold);
+    // the end of the frame is the most recent audio
+    const float * x = vad.frame.data() + vad.frame_size - n;
+
+    // bit-reversed copy followed by an iterative radix-2 FFT
+    int bits = 0;
+    while ((1 << bits) < n) {
+        bits++;
+    }
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        vad.fft_re[r] = x[i]*vad.window[i];
+        vad.fft_im[r] = 0.0f;
     }
 
-    if (energy_last > vad_thold*energy_all) {
-        return false;
+    float * re = vad.fft_re.data();
+    float * im = vad.fft_im.data();
+
+    for (int len = 2; len <= n; len *= 2) {
+        const int half   = len/2;
+        const int stride = n/len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < half; k++) {
+                const float wr = vad.twiddle[2*k*stride + 0];
+                const float wi = vad.twiddle[2*k*stride + 1];
+
+                const float tr = re[i + k + half]*wr - im[i + k + half]*wi;
+                const float ti = re[i + k + half]*wi + im[i + k + half]*wr;
+
+                re[i + k + half] = re[i + k] - tr;
+                im[i + k + half] = im[i + k] - ti;
+                re[i + k]       += tr;
+                im[i + k]       += ti;
+            }
+        }
     }
 
-    return true;
+    // skip the DC bin, the high-pass filter has removed it anyway
+    double sum_log = 0.0;
+    double sum     = 0.0;
+    for (int k = 1; k <= n/2; k++) {
+        const float p = re[k]*re[k] + im[k]*im[k] + 1e-12f;
+        sum_log += logf(p);
+        sum     += p;
+    }
+
+    const int n_bins = n/2;
+    return (float) (exp(sum_log/n_bins)/(sum/n_bins));
+}
+
+static vad_event vad_stream_push_frame(vad_stream & vad) {
+    float sum_sq = 0.0f;
+    int   n_zc   = 0;
+    vad_frame_stats(vad.frame.data(), vad.frame_size, sum_sq, n_zc);
+
+    const float rms = sqrtf(sum_sq/vad.frame_size);
+    const float zcr = (float) n_zc/vad.frame_size;
+
+    const int64_t frame_end   = vad.n_samples;
+    const int64_t frame_start = frame_end - vad.frame_size;
+
+    vad.n_frames++;
+
+    if (vad.n_frames <= vad.n_warmup) {
+        // not enough history - seed the noise floor with the average and assume no speech
+        vad.noise += (rms - vad.noise)/vad.n_frames;
+        return VAD_EVENT_NONE;
+    }
+
+    // speech is louder than the noise floor and either voiced (low zero crossing rate) or not noise-like
+    const bool loud      = vad.vad_thold*rms > vad.noise;
+    const bool is_speech = loud && (zcr < vad.zcr_thold || vad_frame_flatness(vad) < vad.flatness_thold);
+
+    // The floor drops to quiet frames quickly and rises slowly, so steady background noise is absorbed into it
+    // within noise_ms. Speech frames only nudge it to keep long utterances from raising it.
+    if (rms < vad.noise) {
+        vad.noise += 0.5f*(rms - vad.noise);
+    } else {
+        vad.noise += (is_speech ? 0.1f*vad.noise_rise : vad.noise_rise)*(rms - vad.noise);
+    }
+
+    if (is_speech) {
+        vad.run_end = frame_end;
+    }
+
+    if (!vad.speech) {
+        if (!is_speech) {
+            vad.n_run = 0;
+            return VAD_EVENT_NONE;
+        }
+
+        if (vad.n_run++ == 0) {
+            vad.run_start = frame_start;
+        }
+
+        if (vad.n_run >= vad.n_onset) {
+            vad.speech       = true;
+            vad.n_run        = 0;
+            vad.speech_start = vad.run_start;
+            return VAD_EVENT_SPEECH_START;
+        }
+    } else {
+        if (is_speech) {
+            vad.n_run = 0;
+            return VAD_EVENT_NONE;
+        }
+
+        if (++vad.n_run >= vad.n_hangover) {
+            vad.speech     = false;
+            vad.n_run      = 0;
+            vad.speech_end = vad.run_end;
+            return VAD_EVENT_SPEECH_END;
+        }
+    }
+
+    return VAD_EVENT_NONE;
+}
+
+vad_event vad_stream_feed(vad_stream & vad, const float * samples, int n_samples) {
+    vad_event result = VAD_EVENT_NONE;
+
+    for (int i = 0; i < n_samples; i++) {
+        float y = samples[i];
+
+        if (vad.alpha > 0.0f) {
+            y = vad.alpha * (vad.hp_y + samples[i] - vad.hp_x);
+            vad.hp_x = samples[i];
+            vad.hp_y = y;
+        }
+
+        vad.frame[vad.frame_len] = y;
+        vad.n_samples++;
+
+        if (++vad.frame_len == vad.frame_size) {
+            const vad_event event = vad_stream_push_frame(vad);
+            if (event != VAD_EVENT_NONE) {
+                result = event;
+            }
+
+            vad.frame_len = 0;
+        }
+    }
+
+    return result;
 }
 
 float similarity(const std::string & s0, const std::string & s1) {
@@ -31,9 +31,12 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdarg>
+#include <cerrno>
 #include <cstring>
+#include <condition_variable>
 #include <fstream>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
@@ -41,6 +44,34 @@
 #include <regex>
 #include <random>
 #include <functional>
+#include <memory>
+
+#if defined(__has_include)
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#if defined(_POSIX_MAPPED_FILES)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#endif
+#endif
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+#if defined(_MSC_VER) && defined(__AVX2__) && !defined(__FMA__)
+#define __FMA__
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
 
 #if defined(_MSC_VER)
 #pragma warning(disable: 4244 4267) // possible loss of data
@@ -152,6 +183,131 @@ static void whisper_log_callback_default(ggml_log_level level, const char * text
 #define WHISPER_MAX_DECODERS 8
 #define WHISPER_MAX_NODES 4096
 
+//
+// memory mapped model files
+//
+
+// read-only mapping of a whole file, the pages are shared with every other process that maps the same model
+struct whisper_mmap {
+    void * addr = nullptr;
+    size_t size = 0;
+
+    whisper_mmap() = default;
+    whisper_mmap(const whisper_mmap &) = delete;
+    whisper_mmap & operator=(const whisper_mmap &) = delete;
+
+#if defined(_POSIX_MAPPED_FILES)
+    static constexpr bool SUPPORTED = true;
+
+    // returns nullptr if the file can not be mapped
+    static std::unique_ptr<whisper_mmap> open(const char * fname) {
+        const int fd = ::open(fname, O_RDONLY);
+        if (fd == -1) {
+            WHISPER_LOG_WARN("%s: failed to open '%s': %s\n", __func__, fname, strerror(errno));
+            return nullptr;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return nullptr;
+        }
+
+        auto result = std::make_unique<whisper_mmap>();
+        result->size = (size_t) st.st_size;
+
+#ifdef __linux__
+        // advise the kernel to read the file sequentially (increases readahead)
+        if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL)) {
+            WHISPER_LOG_WARN("%s: posix_fadvise(.., POSIX_FADV_SEQUENTIAL) failed: %s\n", __func__, strerror(errno));
+        }
+#endif
+
+        void * addr = mmap(NULL, result->size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (addr == MAP_FAILED) { // NOLINT
+            WHISPER_LOG_WARN("%s: mmap failed: %s\n", __func__, strerror(errno));
+            return nullptr;
+        }
+
+        result->addr = addr;
+
+        // advise the kernel to preload the mapped memory
+        if (posix_madvise(result->addr, result->size, POSIX_MADV_WILLNEED)) {
+            WHISPER_LOG_WARN("%s: posix_madvise(.., POSIX_MADV_WILLNEED) failed: %s\n", __func__, strerror(errno));
+        }
+
+        return result;
+    }
+
+    ~whisper_mmap() {
+        if (addr && munmap(addr, size)) {
+            WHISPER_LOG_WARN("%s: munmap failed: %s\n", __func__, strerror(errno));
+        }
+    }
+#elif defined(_WIN32)
+    static constexpr bool SUPPORTED = true;
+
+    static std::unique_ptr<whisper_mmap> open(const char * fname) {
+        HANDLE hFile = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            WHISPER_LOG_WARN("%s: failed to open '%s'\n", __func__, fname);
+            return nullptr;
+        }
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(hFile, &file_size) || file_size.QuadPart == 0) {
+            CloseHandle(hFile);
+            return nullptr;
+        }
+
+        HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(hFile);
+
+        if (hMapping == NULL) {
+            WHISPER_LOG_WARN("%s: CreateFileMappingA failed: %lu\n", __func__, GetLastError());
+            return nullptr;
+        }
+
+        void * addr = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(hMapping);
+
+        if (addr == NULL) {
+            WHISPER_LOG_WARN("%s: MapViewOfFile failed: %lu\n", __func__, GetLastError());
+            return nullptr;
+        }
+
+        auto result = std::make_unique<whisper_mmap>();
+        result->addr = addr;
+        result->size = (size_t) file_size.QuadPart;
+
+        return result;
+    }
+
+    ~whisper_mmap() {
+        if (addr && !UnmapViewOfFile(addr)) {
+            WHISPER_LOG_WARN("%s: UnmapViewOfFile failed: %lu\n", __func__, GetLastError());
+        }
+    }
+#else
+    static constexpr bool SUPPORTED = false;
+
+    static std::unique_ptr<whisper_mmap> open(const char * /*fname*/) {
+        return nullptr;
+    }
+#endif
+};
+
+// whisper_model_loader context reading from a mapped file
+struct whisper_mmap_reader {
+    const whisper_mmap * mapping = nullptr;
+    size_t offset = 0;
+};
+
+// tensors are used in place when their data in the file is aligned to this
+#define WHISPER_MMAP_ALIGNMENT 4
+
 //
 // ggml helpers
 //
@@ -393,6 +549,14 @@ struct whisper_filters {
     int32_t n_fft;
 
     std::vector<float> data;
+
+    // sparse copy of data, built at load time
+    // band j covers the bins [start[j], start[j] + len[j]), its weights begin at weights[offset[j]] and are
+    // padded with zeros to a multiple of 8
+    std::vector<int32_t> start;
+    std::vector<int32_t> len;
+    std::vector<int32_t> offset;
+    std::vector<float>   weights;
 };
 
 struct whisper_vocab {
@@ -716,6 +880,10 @@ struct whisper_model {
     // the model backend data is read-only and can be shared between processors
     ggml_backend_buffer_t buffer = nullptr;
 
+    // tensors used in place from the mapped model file
+    std::unique_ptr<whisper_mmap> mapping;
+    ggml_backend_buffer_t buffer_mapped = nullptr;
+
     // tensors
     int n_loaded;
     std::map<std::string, struct ggml_tensor *> tensors;
@@ -773,8 +941,9 @@ struct whisper_decoder {
     std::vector<float> logits;
     std::vector<float> logprobs;
 
-    // work container used to avoid memory allocations
+    // work containers used to avoid memory allocations
     std::vector<whisper_pair<double, whisper_vocab::id>> logits_id;
+    std::vector<whisper_token_data>                      tokens_topk;
 
     mutable std::mt19937 rng; // used for sampling at t > 0.0
 };
@@ -786,6 +955,35 @@ struct whisper_aheads_masks {
     ggml_backend_buffer_t buffer = nullptr;
 };
 
+// long-lived worker threads of a whisper_state
+// whisper_worker_pool_run() runs a job on the calling thread (ith = 0) and on n_threads - 1 of the workers, the pool
+// grows on demand. Between jobs the threads spin for a short while before they go to sleep, so the back-to-back jobs
+// of the decoding loop are picked up without a wake-up.
+struct whisper_worker_pool {
+    std::vector<std::thread> threads;
+
+    std::mutex              mutex;
+    std::condition_variable cv_job;
+    std::condition_variable cv_done;
+
+    const std::function<void(int)> * job = nullptr;
+
+    int n_threads  = 0; // threads taking part in the current job
+    int n_sleeping = 0; // workers waiting on cv_job, guarded by mutex
+
+    std::atomic<int>      n_pending  = 0; // workers that have not finished the current job
+    std::atomic<uint64_t> generation = 0; // incremented for every job
+    std::atomic<bool>     stop       = false;
+};
+
+// state of the log mel spectrogram frontend kept between calls
+struct whisper_mel_frontend {
+    int frame_size = 0;
+
+    std::vector<float> hann;
+    std::vector<float> samples_padded;
+};
+
 struct whisper_state {
     int64_t t_sample_us = 0;
     int64_t t_encode_us = 0;
@@ -811,6 +1009,10 @@ struct whisper_state {
 
     whisper_mel mel;
 
+    whisper_mel_frontend mel_frontend;
+
+    whisper_worker_pool workers;
+
     whisper_batch batch;
 
     whisper_decoder decoders[WHISPER_MAX_DECODERS];
@@ -859,6 +1061,11 @@ struct whisper_state {
 
     std::vector<float> energy; // PCM signal energy
 
+    // decoder prompt of the current encoder output and the logits of its last token
+    // the temperature fallback decodes the same prompt again, it reuses the KV cache instead
+    std::vector<whisper_token> prompt_cached;
+    std::vector<float>         prompt_logits;
+
     // [EXPERIMENTAL] Token-level timestamps with DTW
     whisper_aheads_masks aheads_masks;
     ggml_tensor * aheads_cross_QKs = nullptr;
@@ -882,6 +1089,10 @@ struct whisper_context {
 
     whisper_state * state = nullptr;
 
+    // idle states of whisper_full_parallel(), kept for the next call
+    std::mutex                   state_pool_mutex;
+    std::vector<whisper_state *> state_pool;
+
     ggml_backend_t backend = nullptr;
 
     std::string path_model; // populated by whisper_init_from_file_with_params()
@@ -1239,6 +1450,30 @@ static ggml_backend_t whisper_backend_init(const whisper_context_params & params
     return ggml_backend_cpu_init();
 }
 
+// the mel filters are triangles covering a few bins each, keep only the non-zero span of every band
+static void whisper_filters_init_sparse(whisper_filters & filters) {
+    filters.start.resize(filters.n_mel);
+    filters.len.resize(filters.n_mel);
+    filters.offset.resize(filters.n_mel);
+    filters.weights.clear();
+
+    for (int j = 0; j < filters.n_mel; ++j) {
+        const float * row = filters.data.data() + j*filters.n_fft;
+
+        int k0 = 0;
+        int k1 = filters.n_fft;
+        while (k0 < k1 && row[k0]     == 0.0f) k0++;
+        while (k1 > k0 && row[k1 - 1] == 0.0f) k1--;
+
+        filters.start[j]  = k0;
+        filters.len[j]    = k1 - k0;
+        filters.offset[j] = filters.weights.size();
+
+        filters.weights.insert(filters.weights.end(), row + k0, row + k1);
+        filters.weights.resize(filters.weights.size() + (8 - (k1 - k0) % 8) % 8, 0.0f);
+    }
+}
+
 // load the model from a ggml file
 //
 // file format:
@@ -1250,7 +1485,75 @@ static ggml_backend_t whisper_backend_init(const whisper_context_params & params
 //
 // see the convert-pt-to-ggml.py script for details
 //
-static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
+// place the tensors whose data is suitably aligned in the mapped file directly into the mapping
+// scans the tensor records that follow the current read offset, returns the number of mapped tensors
+static int whisper_model_map_tensors(whisper_model & model, const whisper_mmap_reader & reader) {
+    const auto * base = (const uint8_t *) reader.mapping->addr;
+    const size_t size = reader.mapping->size;
+
+    std::vector<std::pair<ggml_tensor *, size_t>> mapped;
+
+    size_t offset = reader.offset;
+    while (offset + 3*sizeof(int32_t) <= size) {
+        int32_t header[3]; // n_dims, length, ttype
+        memcpy(header, base + offset, sizeof(header));
+        offset += sizeof(header);
+
+        const int32_t n_dims = header[0];
+        const int32_t length = header[1];
+
+        if (n_dims < 0 || n_dims > 4 || length < 0 || offset + n_dims*sizeof(int32_t) + length > size) {
+            break;
+        }
+
+        int64_t nelements = 1;
+        for (int i = 0; i < n_dims; ++i) {
+            int32_t ne;
+            memcpy(&ne, base + offset, sizeof(ne));
+            offset += sizeof(ne);
+            nelements *= ne;
+        }
+
+        const std::string name((const char *) base + offset, length);
+        offset += length;
+
+        // anything unexpected is left to the loader, which reports it
+        const auto it = model.tensors.find(name);
+        if (it == model.tensors.end()) {
+            break;
+        }
+
+        auto * tensor = it->second;
+        const size_t nbytes = ggml_nbytes(tensor);
+
+        if (ggml_nelements(tensor) != nelements || offset + nbytes > size) {
+            break;
+        }
+
+        if (offset % WHISPER_MMAP_ALIGNMENT == 0) {
+            mapped.emplace_back(tensor, offset);
+        }
+
+        offset += nbytes;
+    }
+
+    if (mapped.empty()) {
+        return 0;
+    }
+
+    model.buffer_mapped = ggml_backend_cpu_buffer_from_ptr(reader.mapping->addr, size);
+    if (!model.buffer_mapped) {
+        return 0;
+    }
+
+    for (const auto & [tensor, tensor_offset] : mapped) {
+        ggml_backend_tensor_alloc(model.buffer_mapped, tensor, (void *) (base + tensor_offset));
+    }
+
+    return (int) mapped.size();
+}
+
+static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx, whisper_mmap_reader * reader) {
     WHISPER_LOG_INFO("%s: loading model\n", __func__);
 
     const int64_t t_start_us = ggml_time_us();
@@ -1351,6 +1654,8 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         filters.data.resize(filters.n_mel * filters.n_fft);
         loader->read(loader->context, filters.data.data(), filters.data.size() * sizeof(float));
         BYTESWAP_FILTERS(filters);
+
+        whisper_filters_init_sparse(filters);
     }
 
     // load vocab
@@ -1669,15 +1974,29 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         return false;
     }
 
-    // allocate tensors in the backend buffers
-    model.buffer = ggml_backend_alloc_ctx_tensors(model.ctx, wctx.backend);
-    if (!model.buffer) {
-        WHISPER_LOG_ERROR("%s: failed to allocate memory for the model\n", __func__);
-        return false;
+    // with a mapped model file on the CPU backend the aligned tensors are used in place
+    int n_mapped = 0;
+#if !defined(GGML_BIG_ENDIAN)
+    if (reader != nullptr && ggml_backend_is_cpu(wctx.backend)) {
+        n_mapped = whisper_model_map_tensors(model, *reader);
     }
+#endif
+
+    // allocate the remaining tensors in the backend buffers
+    if (n_mapped < (int) model.tensors.size()) {
+        model.buffer = ggml_backend_alloc_ctx_tensors(model.ctx, wctx.backend);
+        if (!model.buffer) {
+            WHISPER_LOG_ERROR("%s: failed to allocate memory for the model\n", __func__);
+            return false;
+        }
 
-    size_t size_main = ggml_backend_buffer_get_size(model.buffer);
-    WHISPER_LOG_INFO("%s: %8s total size = %8.2f MB\n", __func__, ggml_backend_name(wctx.backend), size_main / 1e6);
+        size_t size_main = ggml_backend_buffer_get_size(model.buffer);
+        WHISPER_LOG_INFO("%s: %8s total size = %8.2f MB\n", __func__, ggml_backend_name(wctx.backend), size_main / 1e6);
+    }
+
+    if (n_mapped > 0) {
+        WHISPER_LOG_INFO("%s: %d of %zu tensors mapped from the model file\n", __func__, n_mapped, model.tensors.size());
+    }
 
     // load weights
     {
@@ -1744,7 +2063,10 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
             //printf("%s: [%5.5s] %s\n", __func__, ggml_backend_name(backend), name.c_str());
 
-            if (ggml_backend_buffer_is_host(model.buffer)) {
+            if (model.buffer_mapped && tensor->buffer == model.buffer_mapped) {
+                // the data is used in place, skip over it
+                reader->offset += ggml_nbytes(tensor);
+            } else if (ggml_backend_buffer_is_host(model.buffer)) {
                 // for the CPU and Metal backend, we can read directly into the tensor
                 loader->read(loader->context, tensor->data, ggml_nbytes(tensor));
                 BYTESWAP_TENSOR(tensor);
@@ -2778,102 +3100,370 @@ static std::string to_timestamp(int64_t t, bool comma = false) {
     return std::string(buf);
 }
 
-#define SIN_COS_N_COUNT WHISPER_N_FFT
-static float sin_vals[SIN_COS_N_COUNT];
-static float cos_vals[SIN_COS_N_COUNT];
+// Real FFT
+// A real frame of n samples (n even) is packed into n/2 complex values, transformed with an in-place iterative
+// mixed-radix decimation-in-time FFT (radix 4, 2, 5 and a generic butterfly for any other factor) and unpacked
+// into the n/2 + 1 bins of the real spectrum.
+// Everything that depends only on n is precomputed in a plan, transforming a frame does not allocate.
+struct whisper_fft_plan {
+    int n         = 0; // real input size
+    int m         = 0; // complex transform size (n/2)
+    int max_radix = 0;
+
+    std::vector<int>   factors; // radix of each stage
+    std::vector<int>   perm;    // digit-reversal permutation: position p of the complex input holds z[perm[p]]
+    std::vector<float> twiddle; // per stage: w_L^(q*k), k in [0, L/r), q in [1, r) - interleaved re, im
+    std::vector<float> roots;   // per stage: w_r^j, j in [0, r) - used only by the generic butterfly
+    std::vector<float> unpack;  // w_n^k, k in [0, m] - interleaved re, im
+};
+
+static void whisper_fft_plan_init(whisper_fft_plan & plan, int n) {
+    WHISPER_ASSERT(n >= 2 && n % 2 == 0);
 
-// In FFT, we frequently use sine and cosine operations with the same values.
-// We can use precalculated values to speed up the process.
-static void fill_sin_cos_table() {
-    static bool is_filled = false;
-    if (is_filled) return;
-    for (int i = 0; i < SIN_COS_N_COUNT; i++) {
-        double theta = (2*M_PI*i)/SIN_COS_N_COUNT;
-        sin_vals[i] = sinf(theta);
-        cos_vals[i] = cosf(theta);
+    plan.n = n;
+    plan.m = n/2;
+
+    plan.factors.clear();
+    int rem = plan.m;
+    for (int r : { 4, 2, 5 }) {
+        while (rem % r == 0) {
+            plan.factors.push_back(r);
+            rem /= r;
+        }
+    }
+    for (int r = 3; rem > 1; r += 2) {
+        while (rem % r == 0) {
+            plan.factors.push_back(r);
+            rem /= r;
+        }
+    }
+
+    plan.max_radix = 1;
+    for (int r : plan.factors) {
+        plan.max_radix = std::max(plan.max_radix, r);
+    }
+
+    // the last stage combines r sub-transforms stored in consecutive blocks, sub-transform q holds z[q + r*i]
+    plan.perm.resize(plan.m);
+    for (int p = 0; p < plan.m; ++p) {
+        int idx    = 0;
+        int stride = 1;
+        int pos    = p;
+        int size   = plan.m;
+        for (int s = (int) plan.factors.size() - 1; s >= 0; --s) {
+            size   /= plan.factors[s];
+            idx    += (pos/size)*stride;
+            pos    %= size;
+            stride *= plan.factors[s];
+        }
+        plan.perm[p] = idx;
+    }
+
+    plan.twiddle.clear();
+    plan.roots.clear();
+    for (int s = 0, len = 1; s < (int) plan.factors.size(); ++s) {
+        const int r = plan.factors[s];
+        const int m = len;
+        len *= r;
+
+        for (int k = 0; k < m; ++k) {
+            for (int q = 1; q < r; ++q) {
+                const double theta = -2.0*M_PI*q*k/len;
+                plan.twiddle.push_back(cos(theta));
+                plan.twiddle.push_back(sin(theta));
+            }
+        }
+
+        for (int j = 0; j < r; ++j) {
+            const double theta = -2.0*M_PI*j/r;
+            plan.roots.push_back(cos(theta));
+            plan.roots.push_back(sin(theta));
+        }
+    }
+
+    plan.unpack.resize(2*(plan.m + 1));
+    for (int k = 0; k <= plan.m; ++k) {
+        const double theta = -2.0*M_PI*k/n;
+        plan.unpack[2*k + 0] = cos(theta);
+        plan.unpack[2*k + 1] = sin(theta);
     }
-    is_filled = true;
 }
 
-// naive Discrete Fourier Transform
-// input is real-valued
-// output is complex-valued
-static void dft(const std::vector<float> & in, std::vector<float> & out) {
-    int N = in.size();
+// plans are built on first use and live until the program exits
+static const whisper_fft_plan & whisper_fft_plan_get(int n) {
+    static std::mutex mutex;
+    static std::map<int, whisper_fft_plan> plans;
 
-    out.resize(N*2);
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
+    std::lock_guard<std::mutex> lock(mutex);
 
-    for (int k = 0; k < N; k++) {
-        float re = 0;
-        float im = 0;
+    auto it = plans.find(n);
+    if (it == plans.end()) {
+        it = plans.emplace(n, whisper_fft_plan()).first;
+        whisper_fft_plan_init(it->second, n);
+    }
 
-        for (int n = 0; n < N; n++) {
-            int idx = (k * n * sin_cos_step) % (SIN_COS_N_COUNT); // t = 2*M_PI*k*n/N
-            re += in[n]*cos_vals[idx]; // cos(t)
-            im -= in[n]*sin_vals[idx]; // sin(t)
+    return it->second;
+}
+
+// size of the work buffer needed by whisper_fft_power()
+static size_t whisper_fft_work_size(const whisper_fft_plan & plan) {
+    return 2*plan.m + 2*plan.max_radix;
+}
+
+// in-place complex FFT of plan.m points
+// x is interleaved re, im in digit-reversed order, a holds 2*plan.max_radix floats of scratch
+static void whisper_fft_complex(const whisper_fft_plan & plan, float * x, float * a) {
+    static const float c1 = cosf(2.0f*M_PI/5), s1 = sinf(2.0f*M_PI/5);
+    static const float c2 = cosf(4.0f*M_PI/5), s2 = sinf(4.0f*M_PI/5);
+
+    const float * tw    = plan.twiddle.data();
+    const float * roots = plan.roots.data();
+
+    for (int s = 0, len = 1; s < (int) plan.factors.size(); ++s) {
+        const int r = plan.factors[s];
+        const int m = len;
+        len *= r;
+
+        for (int b = 0; b < plan.m; b += len) {
+            for (int k = 0; k < m; ++k) {
+                float       * p = x  + 2*(b + k);
+                const float * w = tw + 2*(r - 1)*k;
+
+                // a_q = x[b + k + q*m] * w_L^(q*k)
+                a[0] = p[0];
+                a[1] = p[1];
+                for (int q = 1; q < r; ++q) {
+                    const float re = p[2*q*m + 0];
+                    const float im = p[2*q*m + 1];
+                    a[2*q + 0] = re*w[2*(q - 1) + 0] - im*w[2*(q - 1) + 1];
+                    a[2*q + 1] = re*w[2*(q - 1) + 1] + im*w[2*(q - 1) + 0];
+                }
+
+                // r-point DFT of a, written back to x[b + k + j*m]
+                switch (r) {
+                    case 2:
+                        {
+                            p[0]       = a[0] + a[2];
+                            p[1]       = a[1] + a[3];
+                            p[2*m + 0] = a[0] - a[2];
+                            p[2*m + 1] = a[1] - a[3];
+                        } break;
+                    case 4:
+                        {
+                            const float t0r = a[0] + a[4], t0i = a[1] + a[5];
+                            const float t1r = a[0] - a[4], t1i = a[1] - a[5];
+                            const float t2r = a[2] + a[6], t2i = a[3] + a[7];
+                            const float t3r = a[2] - a[6], t3i = a[3] - a[7];
+
+                            p[0]       = t0r + t2r;
+                            p[1]       = t0i + t2i;
+                            p[2*m + 0] = t1r + t3i;
+                            p[2*m + 1] = t1i - t3r;
+                            p[4*m + 0] = t0r - t2r;
+                            p[4*m + 1] = t0i - t2i;
+                            p[6*m + 0] = t1r - t3i;
+                            p[6*m + 1] = t1i + t3r;
+                        } break;
+                    case 5:
+                        {
+                            const float s14r = a[2] + a[8], s14i = a[3] + a[9];
+                            const float d14r = a[2] - a[8], d14i = a[3] - a[9];
+                            const float s23r = a[4] + a[6], s23i = a[5] + a[7];
+                            const float d23r = a[4] - a[6], d23i = a[5] - a[7];
+
+                            const float a1r = a[0] + c1*s14r + c2*s23r, a1i = a[1] + c1*s14i + c2*s23i;
+                            const float a2r = a[0] + c2*s14r + c1*s23r, a2i = a[1] + c2*s14i + c1*s23i;
+                            const float t1r = s1*d14r + s2*d23r,        t1i = s1*d14i + s2*d23i;
+                            const float t2r = s2*d14r - s1*d23r,        t2i = s2*d14i - s1*d23i;
+
+                            p[0]       = a[0] + s14r + s23r;
+                            p[1]       = a[1] + s14i + s23i;
+                            p[2*m + 0] = a1r + t1i;
+                            p[2*m + 1] = a1i - t1r;
+                            p[8*m + 0] = a1r - t1i;
+                            p[8*m + 1] = a1i + t1r;
+                            p[4*m + 0] = a2r + t2i;
+                            p[4*m + 1] = a2i - t2r;
+                            p[6*m + 0] = a2r - t2i;
+                            p[6*m + 1] = a2i + t2r;
+                        } break;
+                    default:
+                        {
+                            for (int j = 0; j < r; ++j) {
+                                float re = 0.0f;
+                                float im = 0.0f;
+                                for (int q = 0; q < r; ++q) {
+                                    const float * root = roots + 2*((q*j) % r);
+                                    re += a[2*q + 0]*root[0] - a[2*q + 1]*root[1];
+                                    im += a[2*q + 0]*root[1] + a[2*q + 1]*root[0];
+                                }
+                                p[2*j*m + 0] = re;
+                                p[2*j*m + 1] = im;
+                            }
+                        } break;
+                }
+            }
         }
 
-        out[k*2 + 0] = re;
-        out[k*2 + 1] = im;
+        tw    += 2*(r - 1)*m;
+        roots += 2*r;
     }
 }
 
-// Cooley-Tukey FFT
-// poor man's implementation - use something better
-// input is real-valued
-// output is complex-valued
-static void fft(const std::vector<float> & in, std::vector<float> & out) {
-    out.resize(in.size()*2);
+// power spectrum |X[k]|^2, k in [0, n/2], of the real frame in[0, n)
+// work must hold whisper_fft_work_size(plan) floats
+static void whisper_fft_power(const whisper_fft_plan & plan, const float * in, float * work, float * out) {
+    const int m = plan.m;
 
-    int N = in.size();
+    // z[i] = in[2i] + i*in[2i + 1], loaded in digit-reversed order
+    float * z = work;
+    for (int p = 0; p < m; ++p) {
+        z[2*p + 0] = in[2*plan.perm[p] + 0];
+        z[2*p + 1] = in[2*plan.perm[p] + 1];
+    }
 
-    if (N == 1) {
-        out[0] = in[0];
-        out[1] = 0;
-        return;
+    whisper_fft_complex(plan, z, work + 2*m);
+
+    // X[k] = E[k] + w_n^k*O[k], E[k] = (Z[k] + Z*[m - k])/2, O[k] = (Z[k] - Z*[m - k])/2i
+    for (int k = 0; k <= m; ++k) {
+        const int k0 = k % m;
+        const int k1 = (m - k) % m;
+
+        const float er = 0.5f*(z[2*k0 + 0] + z[2*k1 + 0]);
+        const float ei = 0.5f*(z[2*k0 + 1] - z[2*k1 + 1]);
+        const float or_ = 0.5f*(z[2*k0 + 1] + z[2*k1 + 1]);
+        const float oi = -0.5f*(z[2*k0 + 0] - z[2*k1 + 0]);
+
+        const float wr = plan.unpack[2*k + 0];
+        const float wi = plan.unpack[2*k + 1];
+
+        const float xr = er + wr*or_ - wi*oi;
+        const float xi = ei + wr*oi + wi*or_;
+
+        out[k] = xr*xr + xi*xi;
+    }
+}
+
+// filter band j applied to the power spectrum
+// power must be readable (and zero) up to 8 values past filters.n_fft, the band weights are padded to 8
+static float whisper_mel_band(const whisper_filters & filters, int j, const float * power) {
+    const float * p = power + filters.start[j];
+    const float * w = filters.weights.data() + filters.offset[j];
+
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 acc = _mm256_setzero_ps();
+    for (int k = 0; k < filters.len[j]; k += 8) {
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(p + k), _mm256_loadu_ps(w + k), acc);
     }
 
-    if (N%2 == 1) {
-        dft(in, out);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+
+    return _mm_cvtss_f32(sum);
+#else
+    double sum = 0.0;
+    for (int k = 0; k < filters.len[j]; ++k) {
+        sum += p[k]*w[k];
+    }
+
+    return sum;
+#endif
+}
+
+// iterations a waiting thread yields before it blocks
+static constexpr int WHISPER_WORKER_POOL_N_SPIN = 256;
+
+static void whisper_worker_pool_thread(whisper_worker_pool & pool, int ith, uint64_t generation) {
+    while (true) {
+        for (int i = 0; i < WHISPER_WORKER_POOL_N_SPIN && pool.generation.load(std::memory_order_acquire) == generation; ++i) {
+            if (pool.stop.load(std::memory_order_relaxed)) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        if (pool.generation.load(std::memory_order_acquire) == generation) {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.n_sleeping++;
+            pool.cv_job.wait(lock, [&] { return pool.stop || pool.generation.load(std::memory_order_relaxed) != generation; });
+            pool.n_sleeping--;
+        }
+
+        if (pool.stop) {
+            return;
+        }
+
+        // job and n_threads are published before the generation is incremented
+        generation = pool.generation.load(std::memory_order_acquire);
+
+        if (ith < pool.n_threads) {
+            (*pool.job)(ith);
+        }
+
+        if (pool.n_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            pool.cv_done.notify_one();
+        }
+    }
+}
+
+// run job(ith) for ith in [0, n_threads), ith = 0 on the calling thread
+static void whisper_worker_pool_run(whisper_worker_pool & pool, int n_threads, const std::function<void(int)> & job) {
+    n_threads = std::max(1, n_threads);
+
+    if (n_threads == 1) {
+        job(0);
         return;
     }
 
-    std::vector<float> even;
-    std::vector<float> odd;
+    bool wake = false;
 
-    even.reserve(N/2);
-    odd.reserve(N/2);
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
 
-    for (int i = 0; i < N; i++) {
-        if (i % 2 == 0) {
-            even.push_back(in[i]);
-        } else {
-            odd.push_back(in[i]);
+        while ((int) pool.threads.size() < n_threads - 1) {
+            pool.threads.emplace_back(whisper_worker_pool_thread, std::ref(pool), (int) pool.threads.size() + 1, pool.generation.load());
         }
+
+        pool.job       = &job;
+        pool.n_threads = n_threads;
+        pool.n_pending.store((int) pool.threads.size(), std::memory_order_relaxed);
+        pool.generation.fetch_add(1, std::memory_order_release);
+
+        wake = pool.n_sleeping > 0;
     }
 
-    std::vector<float> even_fft;
-    std::vector<float> odd_fft;
+    if (wake) {
+        pool.cv_job.notify_all();
+    }
 
-    fft(even, even_fft);
-    fft(odd, odd_fft);
+    job(0);
 
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
-    for (int k = 0; k < N/2; k++) {
-        int idx = k * sin_cos_step; // t = 2*M_PI*k/N
-        float re = cos_vals[idx]; // cos(t)
-        float im = -sin_vals[idx]; // sin(t)
+    for (int i = 0; i < WHISPER_WORKER_POOL_N_SPIN && pool.n_pending.load(std::memory_order_acquire) > 0; ++i) {
+        std::this_thread::yield();
+    }
 
-        float re_odd = odd_fft[2*k + 0];
-        float im_odd = odd_fft[2*k + 1];
+    if (pool.n_pending.load(std::memory_order_acquire) > 0) {
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.cv_done.wait(lock, [&] { return pool.n_pending.load(std::memory_order_acquire) == 0; });
+    }
 
-        out[2*k + 0] = even_fft[2*k + 0] + re*re_odd - im*im_odd;
-        out[2*k + 1] = even_fft[2*k + 1] + re*im_odd + im*re_odd;
+    pool.job = nullptr;
+}
 
-        out[2*(k + N/2) + 0] = even_fft[2*k + 0] - re*re_odd + im*im_odd;
-        out[2*(k + N/2) + 1] = even_fft[2*k + 1] - re*im_odd - im*re_odd;
+static void whisper_worker_pool_free(whisper_worker_pool & pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stop = true;
     }
+
+    pool.cv_job.notify_all();
+
+    for (auto & thread : pool.threads) {
+        thread.join();
+    }
+    pool.threads.clear();
 }
 
 static bool hann_window(int length, bool periodic, std::vector<float> & output) {
@@ -2894,10 +3484,14 @@ static bool hann_window(int length, bool periodic, std::vector<float> & output)
 static void log_mel_spectrogram_worker_thread(int ith, const std::vector<float> & hann, const std::vector<float> & samples,
                                               int n_samples, int frame_size, int frame_step, int n_threads,
                                               const whisper_filters & filters, whisper_mel & mel) {
+    const whisper_fft_plan & plan = whisper_fft_plan_get(frame_size);
+
     std::vector<float> fft_in(frame_size, 0.0);
-    std::vector<float> fft_out(2 * frame_step);
+    std::vector<float> fft_work(whisper_fft_work_size(plan));
     // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
     int n_fft = 1 + (frame_size / 2);
+    // zero tail for the padded filter bands
+    std::vector<float> fft_out(std::max(n_fft, filters.n_fft) + 8, 0.0f);
     int i = ith;
 
     // calculate FFT only when fft_in are not all zero
@@ -2913,33 +3507,12 @@ static void log_mel_spectrogram_worker_thread(int ith, const std::vector<float>
             std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
         }
 
-        // FFT
-        fft(fft_in, fft_out);
-
-        // Calculate modulus^2 of complex numbers
-        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
-        for (int j = 0; j < frame_size; j++) {
-            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
-        }
+        // FFT + modulus^2 of the complex bins
+        whisper_fft_power(plan, fft_in.data(), fft_work.data(), fft_out.data());
 
         // mel spectrogram
         for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-
-            // unroll loop (suggested by GH user @lunixbochs)
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum +=
-                        fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                        fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                        fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                        fft_out[k + 3] * filters.data[j * n_fft + k + 3];
-            }
-
-            // handle n_fft remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
-            }
+            double sum = whisper_mel_band(filters, j, fft_out.data());
 
             sum = log10(std::max(sum, 1e-10));
 
@@ -2971,19 +3544,24 @@ static bool log_mel_spectrogram(
               whisper_mel & mel) {
     const int64_t t_start_us = ggml_time_us();
 
+    // the window and the padded buffer are kept in the state and reused by the following calls
+    auto & frontend = wstate.mel_frontend;
+
     // Hanning window (Use cosf to eliminate difference)
     // ref: https://pytorch.org/docs/stable/generated/torch.hann_window.html
     // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L147
-    std::vector<float> hann;
-    hann_window(frame_size, true, hann);
-
+    auto & hann = frontend.hann;
+    if (frontend.frame_size != frame_size) {
+        hann_window(frame_size, true, hann);
+        frontend.frame_size = frame_size;
+    }
 
     // Calculate the length of padding
     int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
     int64_t stage_2_pad = frame_size / 2;
 
-    // Initialize a vector and copy data from C array to it.
-    std::vector<float> samples_padded;
+    // Copy data from C array into the padded buffer, every element is overwritten below
+    auto & samples_padded = frontend.samples_padded;
     samples_padded.resize(n_samples + stage_1_pad + stage_2_pad * 2);
     std::copy(samples, samples + n_samples, samples_padded.begin() + stage_2_pad);
 
@@ -3003,20 +3581,12 @@ static bool log_mel_spectrogram(
 
 
     {
-        std::vector<std::thread> workers(n_threads - 1);
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw] = std::thread(
-                    log_mel_spectrogram_worker_thread, iw + 1, std::cref(hann), samples_padded,
-                    n_samples + stage_2_pad, frame_size, frame_step, n_threads,
-                    std::cref(filters), std::ref(mel));
-        }
-
-        // main thread
-        log_mel_spectrogram_worker_thread(0, hann, samples_padded, n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, mel);
+        // all threads share the padded buffer and the window by reference
+        const std::function<void(int)> job = [&](int ith) {
+            log_mel_spectrogram_worker_thread(ith, hann, samples_padded, n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, mel);
+        };
 
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw].join();
-        }
+        whisper_worker_pool_run(wstate.workers, n_threads, job);
     }
 
     // clamping and normalization
@@ -3166,7 +3736,7 @@ static std::string whisper_openvino_get_path_cache(std::string path_bin) {
 #endif
 
 struct whisper_state * whisper_init_state(whisper_context * ctx) {
-    fill_sin_cos_table();
+    whisper_fft_plan_get(WHISPER_N_FFT);
 
     whisper_state * state = new whisper_state;
 
@@ -3374,6 +3944,7 @@ struct whisper_context_params whisper_context_default_params() {
     struct whisper_context_params result = {
         /*.use_gpu              =*/ true,
         /*.gpu_device           =*/ 0,
+        /*.use_mmap             =*/ true,
 
         /*.dtw_token_timestamps =*/ false,
         /*.dtw_aheads_preset    =*/ WHISPER_AHEADS_NONE,
@@ -3387,9 +3958,56 @@ struct whisper_context_params whisper_context_default_params() {
     return result;
 }
 
+static struct whisper_context * whisper_init_no_state_impl(struct whisper_model_loader * loader, struct whisper_context_params params, whisper_mmap_reader * reader);
+
 struct whisper_context * whisper_init_from_file_with_params_no_state(const char * path_model, struct whisper_context_params params) {
     WHISPER_LOG_INFO("%s: loading model from '%s'\n", __func__, path_model);
 
+    if (params.use_mmap && whisper_mmap::SUPPORTED) {
+        auto mapping = whisper_mmap::open(path_model);
+        if (mapping) {
+            whisper_mmap_reader reader;
+            reader.mapping = mapping.get();
+
+            whisper_model_loader loader = {};
+
+            loader.context = &reader;
+
+            loader.read = [](void * ctx, void * output, size_t read_size) {
+                auto * reader = (whisper_mmap_reader *) ctx;
+
+                const size_t size_to_copy = std::min(read_size, reader->mapping->size - reader->offset);
+
+                memcpy(output, (const uint8_t *) reader->mapping->addr + reader->offset, size_to_copy);
+                reader->offset += size_to_copy;
+
+                return size_to_copy;
+            };
+
+            loader.eof = [](void * ctx) {
+                auto * reader = (whisper_mmap_reader *) ctx;
+                return reader->offset >= reader->mapping->size;
+            };
+
+            loader.close = [](void * /*ctx*/) { };
+
+            auto ctx = whisper_init_no_state_impl(&loader, params, &reader);
+
+            if (ctx) {
+                ctx->path_model = path_model;
+
+                // keep the mapping alive as long as tensors point into it
+                if (ctx->model.buffer_mapped) {
+                    ctx->model.mapping = std::move(mapping);
+                }
+            }
+
+            return ctx;
+        }
+
+        WHISPER_LOG_WARN("%s: failed to map '%s', reading it instead\n", __func__, path_model);
+    }
+
     auto fin = std::ifstream(path_model, std::ios::binary);
     if (!fin) {
         WHISPER_LOG_ERROR("%s: failed to open '%s'\n", __func__, path_model);
@@ -3462,13 +4080,13 @@ struct whisper_context * whisper_init_from_buffer_with_params_no_state(void * bu
     return whisper_init_with_params_no_state(&loader, params);
 }
 
-struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
+static struct whisper_context * whisper_init_no_state_impl(struct whisper_model_loader * loader, struct whisper_context_params params, whisper_mmap_reader * reader) {
     ggml_time_init();
 
     whisper_context * ctx = new whisper_context;
     ctx->params = params;
 
-    if (!whisper_model_load(loader, *ctx)) {
+    if (!whisper_model_load(loader, *ctx, reader)) {
         loader->close(loader->context);
         WHISPER_LOG_ERROR("%s: failed to load model\n", __func__);
         delete ctx;
@@ -3480,6 +4098,10 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
     return ctx;
 }
 
+struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
+    return whisper_init_no_state_impl(loader, params, nullptr);
+}
+
 struct whisper_context * whisper_init_from_file_with_params(const char * path_model, struct whisper_context_params params) {
     whisper_context * ctx = whisper_init_from_file_with_params_no_state(path_model, params);
     if (!ctx) {
@@ -3570,6 +4192,8 @@ void whisper_free_state(struct whisper_state * state) {
 
         whisper_batch_free(state->batch);
 
+        whisper_worker_pool_free(state->workers);
+
         ggml_gallocr_free(state->alloc_conv.alloc);
         ggml_gallocr_free(state->alloc_encode.alloc);
         ggml_gallocr_free(state->alloc_cross.alloc);
@@ -3589,9 +4213,14 @@ void whisper_free(struct whisper_context * ctx) {
         ggml_free(ctx->model.ctx);
 
         ggml_backend_buffer_free(ctx->model.buffer);
+        ggml_backend_buffer_free(ctx->model.buffer_mapped);
 
         whisper_free_state(ctx->state);
 
+        for (auto * state : ctx->state_pool) {
+            whisper_free_state(state);
+        }
+
         ggml_backend_free(ctx->backend);
 
         delete ctx;
@@ -3668,6 +4297,43 @@ int whisper_set_mel_with_state(
     return 0;
 }
 
+int whisper_pcm_to_mel_frames(
+        struct whisper_context * ctx,
+                   const float * samples,
+                           int   n_frames,
+                         float * out) {
+    const auto & filters = ctx->model.filters;
+    const auto & plan    = whisper_fft_plan_get(WHISPER_N_FFT);
+
+    static const std::vector<float> hann = [] {
+        std::vector<float> window;
+        hann_window(WHISPER_N_FFT, true, window);
+        return window;
+    }();
+
+    const int n_fft = 1 + WHISPER_N_FFT/2;
+
+    std::vector<float> fft_in(WHISPER_N_FFT);
+    std::vector<float> fft_work(whisper_fft_work_size(plan));
+    std::vector<float> fft_out(std::max(n_fft, filters.n_fft) + 8, 0.0f);
+
+    for (int i = 0; i < n_frames; i++) {
+        const float * frame = samples + i*WHISPER_HOP_LENGTH;
+        for (int j = 0; j < WHISPER_N_FFT; j++) {
+            fft_in[j] = hann[j]*frame[j];
+        }
+
+        whisper_fft_power(plan, fft_in.data(), fft_work.data(), fft_out.data());
+
+        for (int j = 0; j < filters.n_mel; j++) {
+            const double sum = whisper_mel_band(filters, j, fft_out.data());
+            out[i*filters.n_mel + j] = log10(std::max(sum, 1e-10));
+        }
+    }
+
+    return 0;
+}
+
 int whisper_set_mel(
         struct whisper_context * ctx,
         const float * data,
@@ -3676,6 +4342,24 @@ int whisper_set_mel(
     return whisper_set_mel_with_state(ctx, ctx->state, data, n_len, n_mel);
 }
 
+const float * whisper_get_mel_from_state(
+          struct whisper_state * state,
+                           int * n_mel,
+                           int * n_len) {
+    if (state->mel.data.empty()) {
+        return nullptr;
+    }
+
+    if (n_mel) {
+        *n_mel = state->mel.n_mel;
+    }
+    if (n_len) {
+        *n_len = state->mel.n_len;
+    }
+
+    return state->mel.data.data();
+}
+
 int whisper_encode_with_state(struct whisper_context * ctx, struct whisper_state * state, int offset, int n_threads) {
     if (!whisper_encode_internal(*ctx, *state, offset, n_threads, nullptr, nullptr)) {
         WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
@@ -3716,6 +4400,116 @@ int whisper_decode(struct whisper_context * ctx, const whisper_token * tokens, i
     return whisper_decode_with_state(ctx, ctx->state, tokens, n_tokens, n_past, n_threads);
 }
 
+int whisper_score_candidates_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+           const whisper_token * prompt,
+                           int   n_prompt,
+   const whisper_token * const * candidates,
+                     const int * n_candidate_tokens,
+                           int   n_candidates,
+                         float * scores,
+                           int   n_threads) {
+    const int n_vocab    = ctx->model.hparams.n_vocab;
+    const int n_text_ctx = ctx->model.hparams.n_text_ctx;
+
+    if (n_prompt <= 0) {
+        WHISPER_LOG_ERROR("%s: the prompt must not be empty\n", __func__);
+        return -1;
+    }
+
+    // every candidate token except the last one is fed to the decoder, the prompt provides the logits of the first one
+    int n_batch = 0;
+    for (int i = 0; i < n_candidates; ++i) {
+        if (n_candidate_tokens[i] <= 0) {
+            WHISPER_LOG_ERROR("%s: candidate %d is empty\n", __func__, i);
+            return -2;
+        }
+        n_batch += n_candidate_tokens[i] - 1;
+    }
+
+    if (n_prompt + n_batch > n_text_ctx) {
+        WHISPER_LOG_ERROR("%s: too many tokens: %d (max %d)\n", __func__, n_prompt + n_batch, n_text_ctx);
+        return -3;
+    }
+
+    const auto log_softmax = [n_vocab](const float * logits, whisper_token token) {
+        float max = -INFINITY;
+        for (int i = 0; i < n_vocab; ++i) {
+            max = std::max(max, logits[i]);
+        }
+
+        double sum = 0.0;
+        for (int i = 0; i < n_vocab; ++i) {
+            sum += expf(logits[i] - max);
+        }
+
+        return logits[token] - max - (float) log(sum);
+    };
+
+    // the prompt goes to sequence 0, candidate i continues it as sequence i + 1
+    whisper_kv_cache_clear(state->kv_self);
+
+    whisper_batch_prep_legacy(state->batch, prompt, n_prompt, 0, 0);
+    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, false, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to decode the prompt\n", __func__);
+        return -4;
+    }
+
+    for (int i = 0; i < n_candidates; ++i) {
+        scores[i] = log_softmax(state->logits.data() + (n_prompt - 1)*n_vocab, candidates[i][0]);
+    }
+
+    if (n_batch > 0) {
+        for (int i = 0; i < n_candidates; ++i) {
+            whisper_kv_cache_seq_cp(state->kv_self, 0, i + 1, -1, -1);
+        }
+
+        auto & batch = state->batch;
+        batch.n_tokens = 0;
+
+        for (int i = 0; i < n_candidates; ++i) {
+            for (int j = 0; j < n_candidate_tokens[i] - 1; ++j) {
+                batch.token   [batch.n_tokens]    = candidates[i][j];
+                batch.pos     [batch.n_tokens]    = n_prompt + j;
+                batch.n_seq_id[batch.n_tokens]    = 1;
+                batch.seq_id  [batch.n_tokens][0] = i + 1;
+                batch.logits  [batch.n_tokens]    = 1;
+                batch.n_tokens++;
+            }
+        }
+
+        const bool ok = whisper_decode_internal(*ctx, *state, batch, n_threads, false, nullptr, nullptr);
+
+        for (int i = 0; i < n_candidates; ++i) {
+            whisper_kv_cache_seq_rm(state->kv_self, i + 1, -1, -1);
+        }
+
+        if (!ok) {
+            WHISPER_LOG_ERROR("%s: failed to decode the candidates\n", __func__);
+            return -5;
+        }
+
+        int i_batch = 0;
+        for (int i = 0; i < n_candidates; ++i) {
+            for (int j = 1; j < n_candidate_tokens[i]; ++j) {
+                scores[i] += log_softmax(state->logits.data() + i_batch*n_vocab, candidates[i][j]);
+                i_batch++;
+            }
+        }
+    }
+
+    for (int i = 0; i < n_candidates; ++i) {
+        scores[i] /= n_candidate_tokens[i];
+    }
+
+    return 0;
+}
+
+void whisper_set_audio_ctx_with_state(struct whisper_state * state, int audio_ctx) {
+    state->exp_n_audio_ctx = audio_ctx > 0 ? audio_ctx : 0;
+}
+
 int whisper_tokenize(struct whisper_context * ctx, const char * text, whisper_token * tokens, int n_max_tokens) {
     const auto res = tokenize(ctx->vocab, text);
 
@@ -4028,20 +4822,24 @@ void whisper_print_timings(struct whisper_context * ctx) {
     WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", __func__, (t_end_us - ctx->t_start_us)/1000.0f);
 }
 
+static void whisper_reset_state_timings(struct whisper_state * state) {
+    state->t_mel_us = 0;
+    state->t_sample_us = 0;
+    state->t_encode_us = 0;
+    state->t_decode_us = 0;
+    state->t_batchd_us = 0;
+    state->t_prompt_us = 0;
+    state->n_sample = 0;
+    state->n_encode = 0;
+    state->n_decode = 0;
+    state->n_batchd = 0;
+    state->n_prompt = 0;
+}
+
 void whisper_reset_timings(struct whisper_context * ctx) {
     ctx->t_start_us = ggml_time_us();
     if (ctx->state != nullptr) {
-        ctx->state->t_mel_us = 0;
-        ctx->state->t_sample_us = 0;
-        ctx->state->t_encode_us = 0;
-        ctx->state->t_decode_us = 0;
-        ctx->state->t_batchd_us = 0;
-        ctx->state->t_prompt_us = 0;
-        ctx->state->n_sample = 0;
-        ctx->state->n_encode = 0;
-        ctx->state->n_decode = 0;
-        ctx->state->n_batchd = 0;
-        ctx->state->n_prompt = 0;
+        whisper_reset_state_timings(ctx->state);
     }
 }
 
@@ -4550,6 +5348,7 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.speed_up          =*/ false,
         /*.debug_mode        =*/ false,
         /*.audio_ctx         =*/ 0,
+        /*.mel_from_state    =*/ false,
 
         /*.tdrz_enable       =*/ false,
 
@@ -5071,7 +5870,8 @@ static whisper_token_data whisper_sample_token(
     return result;
 }
 
-static std::vector<whisper_token_data> whisper_sample_token_topk(
+// samples k tokens into decoder.tokens_topk
+static void whisper_sample_token_topk(
             whisper_context & ctx,
             whisper_decoder & decoder,
                         int   k) {
@@ -5101,8 +5901,8 @@ static std::vector<whisper_token_data> whisper_sample_token_topk(
         });
     }
 
-    std::vector<whisper_token_data> result;
-    result.reserve(k);
+    auto & result = decoder.tokens_topk;
+    result.clear();
 
     whisper_token tid = vocab.token_beg;
 
@@ -5142,8 +5942,6 @@ static std::vector<whisper_token_data> whisper_sample_token_topk(
             result[i].pt  = result[i].p;
         }
     }
-
-    return result;
 }
 
 // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L178-L192
@@ -5206,7 +6004,7 @@ int whisper_full_with_state(
 
     result_all.clear();
 
-    if (n_samples > 0) {
+    if (n_samples > 0 && !params.mel_from_state) {
         // compute log mel spectrogram
         if (params.speed_up) {
             // TODO: Replace PV with more advanced algorithm
@@ -5376,18 +6174,36 @@ int whisper_full_with_state(
     std::vector<whisper_token> prompt;
     prompt.reserve(whisper_n_text_ctx(ctx));
 
+    // a beam search candidate is its parent decoder extended by one token
+    // the sequence and the grammar stacks of the parent are only copied when a candidate is selected for another
+    // decoder, the copies go through beam_states so their buffers are reused from step to step
     struct beam_candidate {
         int decoder_idx;
         int seek_delta;
 
         bool has_ts;
 
+        whisper_token_data token;
+        double sum_logprobs_all;
+    };
+
+    struct beam_state {
         whisper_sequence sequence;
-        whisper_grammar grammar;
+
+        std::vector<std::vector<const whisper_grammar_element *>> stacks;
+        whisper_partial_utf8 partial_utf8;
     };
 
     std::vector<std::vector<beam_candidate>> bc_per_dec(n_decoders);
     std::vector<beam_candidate> beam_candidates;
+    std::vector<beam_candidate> beam_selected(n_decoders);
+    std::vector<beam_state> beam_states(n_decoders);
+
+    const auto beam_candidates_equal = [&](const beam_candidate & a, const beam_candidate & b) {
+        return a.token.id == b.token.id &&
+            (a.decoder_idx == b.decoder_idx ||
+             whisper_sequence_tokens_equal(state->decoders[a.decoder_idx].sequence, state->decoders[b.decoder_idx].sequence));
+    };
 
     // main loop
     while (true) {
@@ -5416,6 +6232,8 @@ int whisper_full_with_state(
             return -6;
         }
 
+        state->prompt_cached.clear();
+
         // if there is a very short audio segment left to process, we remove any past prompt since it tends
         // to confuse the decoder and often make it repeat or hallucinate stuff
         if (seek > seek_start && seek + 500 >= seek_end) {
@@ -5476,7 +6294,6 @@ int whisper_full_with_state(
             }
 
             // init prompt and kv cache for the current iteration
-            // TODO: do not recompute the prompt if it is the same as previous time
             {
                 prompt.clear();
 
@@ -5498,20 +6315,37 @@ int whisper_full_with_state(
                 }
                 WHISPER_LOG_DEBUG("\n\n");
 
-                whisper_kv_cache_clear(state->kv_self);
+                const int n_vocab = ctx->vocab.n_vocab;
+
+                if (prompt == state->prompt_cached) {
+                    // same audio and prompt as the previous temperature - drop the generated tokens and the other
+                    // decoders from the KV cache, the prompt cells of sequence 0 stay
+                    whisper_kv_cache_seq_rm(state->kv_self, -1, prompt.size(), -1);
+                    for (int j = 1; j < WHISPER_MAX_DECODERS; ++j) {
+                        whisper_kv_cache_seq_rm(state->kv_self, j, -1, -1);
+                    }
+
+                    state->logits.assign(state->prompt_logits.begin(), state->prompt_logits.end());
+                    state->decoders[0].i_batch = 0;
+                } else {
+                    whisper_kv_cache_clear(state->kv_self);
 
-                whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
+                    whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
 
-                if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
-                    WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
-                    return -7;
+                    if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                        WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                        state->prompt_cached.clear();
+                        return -7;
+                    }
+
+                    state->prompt_cached = prompt;
+                    state->prompt_logits.assign(state->logits.begin() + (prompt.size() - 1)*n_vocab, state->logits.begin() + prompt.size()*n_vocab);
+                    state->decoders[0].i_batch = prompt.size() - 1;
                 }
 
                 {
                     const int64_t t_start_sample_us = ggml_time_us();
 
-                    state->decoders[0].i_batch = prompt.size() - 1;
-
                     whisper_process_logits(*ctx, *state, state->decoders[0], params, t_cur);
 
                     for (int j = 1; j < n_decoders_cur; ++j) {
@@ -5538,7 +6372,7 @@ int whisper_full_with_state(
                 }
 
                 // sampling
-                // TODO: avoid memory allocations, optimize, avoid threads?
+                // TODO: avoid memory allocations, optimize
                 {
                     std::atomic<int> j_cur(0);
 
@@ -5569,35 +6403,18 @@ int whisper_full_with_state(
                                     } break;
                                 case whisper_sampling_strategy::WHISPER_SAMPLING_BEAM_SEARCH:
                                     {
-                                        const auto tokens_new = whisper_sample_token_topk(*ctx, decoder, params.beam_search.beam_size);
+                                        whisper_sample_token_topk(*ctx, decoder, params.beam_search.beam_size);
 
-                                        for (const auto & token : tokens_new) {
-                                            bc_per_dec[j].push_back({ j, decoder.seek_delta, decoder.has_ts, decoder.sequence, decoder.grammar, });
-                                            bc_per_dec[j].back().sequence.tokens.push_back(token);
-                                            bc_per_dec[j].back().sequence.sum_logprobs_all += token.plog;
+                                        for (const auto & token : decoder.tokens_topk) {
+                                            bc_per_dec[j].push_back({ j, decoder.seek_delta, decoder.has_ts, token, decoder.sequence.sum_logprobs_all + token.plog, });
                                         }
                                     } break;
                             };
                         }
                     };
 
-                    const int n_threads = std::min(params.n_threads, n_decoders_cur);
-
-                    if (n_threads == 1) {
-                        process();
-                    } else {
-                        std::vector<std::thread> threads(n_threads - 1);
-
-                        for (int t = 0; t < n_threads - 1; ++t) {
-                            threads[t] = std::thread(process);
-                        }
-
-                        process();
-
-                        for (int t = 0; t < n_threads - 1; ++t) {
-                            threads[t].join();
-                        }
-                    }
+                    // the decoders are handed out through j_cur, so faster threads take over the remaining ones
+                    whisper_worker_pool_run(state->workers, std::min(params.n_threads, n_decoders_cur), [&](int) { process(); });
                 }
 
                 beam_candidates.clear();
@@ -5615,8 +6432,8 @@ int whisper_full_with_state(
                             beam_candidates.begin(),
                             beam_candidates.end(),
                             [](const beam_candidate & a, const beam_candidate & b) {
-                        if (a.sequence.sum_logprobs_all != b.sequence.sum_logprobs_all) {
-                            return a.sequence.sum_logprobs_all > b.sequence.sum_logprobs_all;
+                        if (a.sum_logprobs_all != b.sum_logprobs_all) {
+                            return a.sum_logprobs_all > b.sum_logprobs_all;
                         }
                         return a.decoder_idx < b.decoder_idx;
                     });
@@ -5636,16 +6453,50 @@ int whisper_full_with_state(
 
                         auto & cur = beam_candidates[cur_c++];
 
-                        while (beam_candidates.size() > cur_c && whisper_sequence_tokens_equal(beam_candidates[cur_c].sequence, cur.sequence) && i > 0) {
+                        while (beam_candidates.size() > cur_c && beam_candidates_equal(beam_candidates[cur_c], cur) && i > 0) {
                             ++cur_c;
                         }
 
+                        beam_selected[j] = cur;
+
+                        whisper_kv_cache_seq_cp(state->kv_self, cur.decoder_idx, WHISPER_MAX_DECODERS + j, -1, -1);
+                    }
+
+                    // copy the sequences that move to another decoder before any decoder is updated
+                    for (int j = 0; j < n_decoders_cur; ++j) {
+                        const auto & decoder = state->decoders[j];
+
+                        if (decoder.completed || decoder.failed || beam_selected[j].decoder_idx == j) {
+                            continue;
+                        }
+
+                        const auto & parent = state->decoders[beam_selected[j].decoder_idx];
+
+                        beam_states[j].sequence     = parent.sequence;
+                        beam_states[j].stacks       = parent.grammar.stacks;
+                        beam_states[j].partial_utf8 = parent.grammar.partial_utf8;
+                    }
+
+                    for (int j = 0; j < n_decoders_cur; ++j) {
+                        auto & decoder = state->decoders[j];
+
+                        if (decoder.completed || decoder.failed) {
+                            continue;
+                        }
+
+                        const auto & cur = beam_selected[j];
+
+                        if (cur.decoder_idx != j) {
+                            std::swap(decoder.sequence,       beam_states[j].sequence);
+                            std::swap(decoder.grammar.stacks, beam_states[j].stacks);
+                            decoder.grammar.partial_utf8 = beam_states[j].partial_utf8;
+                        }
+
                         decoder.seek_delta = cur.seek_delta;
                         decoder.has_ts     = cur.has_ts;
-                        decoder.sequence   = cur.sequence;
-                        decoder.grammar    = cur.grammar;
 
-                        whisper_kv_cache_seq_cp(state->kv_self, cur.decoder_idx, WHISPER_MAX_DECODERS + j, -1, -1);
+                        decoder.sequence.tokens.push_back(cur.token);
+                        decoder.sequence.sum_logprobs_all = cur.sum_logprobs_all;
 
                         WHISPER_LOG_DEBUG("%s: beam search: decoder %d: from decoder %d: token = %10s, plog = %8.5f, sum_logprobs = %8.5f\n",
                                 __func__, j, cur.decoder_idx, ctx->vocab.id_to_token.at(decoder.sequence.tokens.back().id).c_str(), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
@@ -5809,7 +6660,7 @@ int whisper_full_with_state(
 
                     const int64_t t_start_sample_us = ggml_time_us();
 
-                    // TODO: avoid memory allocations, optimize, avoid threads?
+                    // TODO: avoid memory allocations, optimize
                     {
                         std::atomic<int> j_cur(0);
 
@@ -5831,23 +6682,7 @@ int whisper_full_with_state(
                             }
                         };
 
-                        const int n_threads = std::min(params.n_threads, n_decoders_cur);
-
-                        if (n_threads == 1) {
-                            process();
-                        } else {
-                            std::vector<std::thread> threads(n_threads - 1);
-
-                            for (int t = 0; t < n_threads - 1; ++t) {
-                                threads[t] = std::thread(process);
-                            }
-
-                            process();
-
-                            for (int t = 0; t < n_threads - 1; ++t) {
-                                threads[t].join();
-                            }
-                        }
+                        whisper_worker_pool_run(state->workers, std::min(params.n_threads, n_decoders_cur), [&](int) { process(); });
                     }
 
                     state->t_sample_us += ggml_time_us() - t_start_sample_us;
@@ -6074,6 +6909,90 @@ int whisper_full(
     return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
 }
 
+// forget what a previous whisper_full call left in the state, so that a pooled state decodes like a fresh one
+static void whisper_reset_state_decoding(struct whisper_state * state) {
+    state->result_all.clear();
+    state->prompt_past.clear();
+    state->prompt_cached.clear();
+    state->prompt_logits.clear();
+    state->energy.clear();
+
+    state->lang_id  = 0;
+    state->t_beg    = 0;
+    state->t_last   = 0;
+    state->tid_last = 0;
+
+    state->exp_n_audio_ctx = 0;
+
+    state->decoders[0].rng = std::mt19937(0);
+}
+
+// take an idle state of the context or create a new one
+static struct whisper_state * whisper_state_pool_acquire(struct whisper_context * ctx) {
+    {
+        std::lock_guard<std::mutex> lock(ctx->state_pool_mutex);
+        if (!ctx->state_pool.empty()) {
+            auto * state = ctx->state_pool.back();
+            ctx->state_pool.pop_back();
+
+            whisper_reset_state_timings(state);
+            whisper_reset_state_decoding(state);
+
+            return state;
+        }
+    }
+
+    return whisper_init_state(ctx);
+}
+
+static void whisper_state_pool_release(struct whisper_context * ctx, struct whisper_state * state) {
+    std::lock_guard<std::mutex> lock(ctx->state_pool_mutex);
+    ctx->state_pool.push_back(state);
+}
+
+// find the quietest 200 ms of audio within radius samples of target, so that a chunk boundary does not cut through
+// speech - returns the sample in the middle of that stretch, ties go to the one closest to target
+static int whisper_find_split(const float * samples, int n_samples, int target, int radius) {
+    const int n_frame = WHISPER_SAMPLE_RATE/100;
+    const int n_avg   = 20;
+
+    const int begin    = std::max(0, target - radius);
+    const int end      = std::min(n_samples, target + radius);
+    const int n_frames = (end - begin)/n_frame;
+
+    if (n_frames <= n_avg) {
+        return target;
+    }
+
+    std::vector<double> energy(n_frames, 0.0);
+    for (int f = 0; f < n_frames; ++f) {
+        const float * x = samples + begin + f*n_frame;
+        for (int i = 0; i < n_frame; ++i) {
+            energy[f] += x[i]*x[i];
+        }
+    }
+
+    double sum = 0.0;
+    for (int f = 0; f < n_avg; ++f) {
+        sum += energy[f];
+    }
+
+    const auto center = [&](int f0) { return begin + (f0 + n_avg/2)*n_frame; };
+
+    int    best_f0  = 0;
+    double best_sum = sum;
+    for (int f0 = 1; f0 + n_avg <= n_frames; ++f0) {
+        sum += energy[f0 + n_avg - 1] - energy[f0 - 1];
+
+        if (sum < best_sum || (sum == best_sum && std::abs(center(f0) - target) < std::abs(center(best_f0) - target))) {
+            best_sum = sum;
+            best_f0  = f0;
+        }
+    }
+
+    return center(best_f0);
+}
+
 int whisper_full_parallel(
         struct whisper_context * ctx,
         struct whisper_full_params params,
@@ -6085,22 +7004,40 @@ int whisper_full_parallel(
     }
     int ret = 0;
 
-    // prepare separate states for each thread
-    std::vector<whisper_state*> states;
-
     const int offset_samples = (WHISPER_SAMPLE_RATE*params.offset_ms)/1000;
     const int n_samples_per_processor = (n_samples - offset_samples)/n_processors;
 
+    // move every boundary to the quietest point around its even split
+    const int radius = std::min(n_samples_per_processor/4, 10*WHISPER_SAMPLE_RATE);
+
+    std::vector<int> splits(n_processors + 1);
+    splits[0]            = offset_samples;
+    splits[n_processors] = n_samples;
+    for (int i = 1; i < n_processors; ++i) {
+        splits[i] = std::max(splits[i - 1], whisper_find_split(samples, n_samples, offset_samples + i*n_samples_per_processor, radius));
+    }
+
+    // take separate states for each thread from the pool of the context
+    std::vector<whisper_state*> states;
+    for (int i = 0; i < n_processors - 1; ++i) {
+        auto * state = whisper_state_pool_acquire(ctx);
+        if (state == nullptr) {
+            WHISPER_LOG_ERROR("%s: failed to initialize state for processor %d\n", __func__, i + 1);
+            for (auto * s : states) {
+                whisper_state_pool_release(ctx, s);
+            }
+            return -1;
+        }
+        states.push_back(state);
+    }
+
     // the calling thread will process the first chunk
     // while the other threads will process the remaining chunks
 
     std::vector<std::thread> workers(n_processors - 1);
     for (int i = 0; i < n_processors - 1; ++i) {
-        // create a new state for each thread
-        states.push_back(whisper_init_state(ctx));
-
-        const int start_samples = offset_samples + (i + 1)*n_samples_per_processor;
-        const int n_samples_cur = (i == n_processors - 2) ? n_samples - start_samples : n_samples_per_processor;
+        const int start_samples = splits[i + 1];
+        const int n_samples_cur = splits[i + 2] - start_samples;
 
         auto params_cur = params;
 
@@ -6124,7 +7061,7 @@ int whisper_full_parallel(
         params_cur.print_realtime = false;
 
         // Run the first transformation using default state but only for the first chunk.
-        ret = whisper_full_with_state(ctx, ctx->state, std::move(params_cur), samples, offset_samples + n_samples_per_processor);
+        ret = whisper_full_with_state(ctx, ctx->state, std::move(params_cur), samples, splits[1]);
     }
 
     for (int i = 0; i < n_processors - 1; ++i) {
@@ -6137,10 +7074,12 @@ int whisper_full_parallel(
     for (int i = 0; i < n_processors - 1; ++i) {
         auto& results_i = states[i]->result_all;
 
+        const int64_t start_t = (100*(int64_t) (splits[i + 1] - offset_samples))/WHISPER_SAMPLE_RATE + offset_t;
+
         for (auto& result : results_i) {
             // correct the segment timestamp taking into account the offset
-            result.t0 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
-            result.t1 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
+            result.t0 += start_t;
+            result.t1 += start_t;
 
             // make sure that segments are not overlapping
             if (!ctx->state->result_all.empty()) {
@@ -6155,6 +7094,8 @@ int whisper_full_parallel(
             }
         }
 
+        results_i.clear();
+
         ctx->state->t_mel_us += states[i]->t_mel_us;
 
         ctx->state->t_sample_us += states[i]->t_sample_us;
@@ -6169,7 +7110,7 @@ int whisper_full_parallel(
         ctx->state->n_batchd += states[i]->n_batchd;
         ctx->state->n_prompt += states[i]->n_prompt;
 
-        whisper_free_state(states[i]);
+        whisper_state_pool_release(ctx, states[i]);
     }
 
     // average the timings
@@ -6179,12 +7120,11 @@ int whisper_full_parallel(
     ctx->state->t_decode_us /= n_processors;
 
     // print information about the audio boundaries
-    WHISPER_LOG_WARN("\n");
-    WHISPER_LOG_WARN("%s: the audio has been split into %d chunks at the following times:\n", __func__, n_processors);
-    for (int i = 0; i < n_processors - 1; ++i) {
-        WHISPER_LOG_WARN("%s: split %d - %s\n", __func__, (i + 1), to_timestamp(100*((i + 1)*n_samples_per_processor)/WHISPER_SAMPLE_RATE + offset_t).c_str());
+    WHISPER_LOG_INFO("\n");
+    WHISPER_LOG_INFO("%s: the audio has been split into %d chunks at the following times:\n", __func__, n_processors);
+    for (int i = 1; i < n_processors; ++i) {
+        WHISPER_LOG_INFO("%s: split %d - %s\n", __func__, i, to_timestamp((100*(int64_t) (splits[i] - offset_samples))/WHISPER_SAMPLE_RATE + offset_t).c_str());
     }
-    WHISPER_LOG_WARN("%s: the transcription quality may be degraded near these boundaries\n", __func__);
 
     return ret;
 }